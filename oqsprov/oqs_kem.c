@@ -6,11 +6,16 @@
  * Code strongly inspired by OpenSSL rsa kem.
  * 
  * ToDo: Adding hybrid alg support; More testing with more key types.
+ *
+ * ToDo: Splitting FrodoKEM's A-row generation and matrix products across
+ * threads requires hooks inside liboqs' Frodo code; OQS_KEM_encaps/decaps
+ * offer no way to do this from the provider.
  */
 
 #include <openssl/crypto.h>
 #include <openssl/evp.h>
 #include <openssl/ec.h>
+#include <openssl/kdf.h>
 #include <openssl/core_dispatch.h>
 #include <openssl/core_names.h>
 #include <openssl/params.h>
@@ -28,15 +33,20 @@
 #define OQS_KEM_PRINTF3(a, b, c) if (getenv("OQSKEM")) printf(a, b, c)
 #endif // NDEBUG
 
+// as in oqs_sig.c, following OSSL settings
+#define OSSL_MAX_NAME_SIZE 50
+
 
 static OSSL_FUNC_kem_newctx_fn oqs_kem_newctx;
 static OSSL_FUNC_kem_encapsulate_init_fn oqs_kem_encaps_init;
-static OSSL_FUNC_kem_encapsulate_fn oqs_qs_kem_encaps;
-static OSSL_FUNC_kem_encapsulate_fn oqs_hyb_kem_encaps;
-static OSSL_FUNC_kem_decapsulate_init_fn oqs_qs_kem_decaps_init;
-static OSSL_FUNC_kem_decapsulate_fn oqs_qs_kem_decaps;
-static OSSL_FUNC_kem_decapsulate_fn oqs_hyb_kem_decaps;
+static OSSL_FUNC_kem_encapsulate_fn oqs_kem_encaps;
+static OSSL_FUNC_kem_decapsulate_init_fn oqs_kem_decaps_init;
+static OSSL_FUNC_kem_decapsulate_fn oqs_kem_decaps;
 static OSSL_FUNC_kem_freectx_fn oqs_kem_freectx;
+static OSSL_FUNC_kem_get_ctx_params_fn oqs_kem_get_ctx_params;
+static OSSL_FUNC_kem_gettable_ctx_params_fn oqs_kem_gettable_ctx_params;
+static OSSL_FUNC_kem_set_ctx_params_fn oqs_kem_set_ctx_params;
+static OSSL_FUNC_kem_settable_ctx_params_fn oqs_kem_settable_ctx_params;
 
 /*
  * What's passed as an actual key is defined by the KEYMGMT interface.
@@ -44,6 +54,14 @@ static OSSL_FUNC_kem_freectx_fn oqs_kem_freectx;
 typedef struct {
     OSSL_LIB_CTX *libctx;
     OQSX_KEY *kem;
+    OQSX_SCRATCH scratch;
+    /* If set, public keys (of kem's algorithm) to encapsulate to instead */
+    unsigned char *recipients;
+    size_t num_recipients;
+    /* If set, HKDF (digest, salt, info configured; never keyed) applied to each secret */
+    EVP_KDF_CTX *kdf;
+    size_t kdf_len;
+    uint64_t deadline;
 } PROV_OQSKEM_CTX;
 
 /// Common KEM functions
@@ -66,6 +84,8 @@ static void oqs_kem_freectx(void *vpkemctx)
     PROV_OQSKEM_CTX *pkemctx = (PROV_OQSKEM_CTX *)vpkemctx;
 
     OQS_KEM_PRINTF("OQS KEM provider called: freectx\n");
+    OPENSSL_free(pkemctx->recipients);
+    EVP_KDF_CTX_free(pkemctx->kdf);
     oqsx_key_free(pkemctx->kem);
     OPENSSL_free(pkemctx);
 }
@@ -79,6 +99,10 @@ static int oqs_kem_decapsencaps_init(void *vpkemctx, void *vkem, int operation)
         return 0;
     oqsx_key_free(pkemctx->kem);
     pkemctx->kem = vkem;
+    // recipients must match the key's algorithm: (re)set via params only
+    OPENSSL_free(pkemctx->recipients);
+    pkemctx->recipients = NULL;
+    pkemctx->num_recipients = 0;
 
     return 1;
 }
@@ -86,106 +110,217 @@ static int oqs_kem_decapsencaps_init(void *vpkemctx, void *vkem, int operation)
 static int oqs_kem_encaps_init(void *vpkemctx, void *vkem, const OSSL_PARAM params[])
 {
     OQS_KEM_PRINTF("OQS KEM provider called: encaps_init\n");
-    return oqs_kem_decapsencaps_init(vpkemctx, vkem, EVP_PKEY_OP_ENCAPSULATE);
+    return oqs_kem_decapsencaps_init(vpkemctx, vkem, EVP_PKEY_OP_ENCAPSULATE)
+           && oqs_kem_set_ctx_params(vpkemctx, params);
 }
 
 static int oqs_kem_decaps_init(void *vpkemctx, void *vkem, const OSSL_PARAM params[])
 {
     OQS_KEM_PRINTF("OQS KEM provider called: decaps_init\n");
-    return oqs_kem_decapsencaps_init(vpkemctx, vkem, EVP_PKEY_OP_DECAPSULATE);
+    return oqs_kem_decapsencaps_init(vpkemctx, vkem, EVP_PKEY_OP_DECAPSULATE)
+           && oqs_kem_set_ctx_params(vpkemctx, params);
 }
 
-/// Quantum-Safe KEM functions (OQS)
+/*
+ * Scratch memory an operation carves from the caller-supplied arena: the
+ * raw shared secrets that the KDF turns into the returned ones.
+ */
+static size_t oqs_kem_scratch_size(const PROV_OQSKEM_CTX *pkemctx)
+{
+    size_t n;
 
-static int oqs_qs_kem_encaps_keyslot(void *vpkemctx, unsigned char *out, size_t *outlen,
-                                     unsigned char *secret, size_t *secretlen, int keyslot)
+    if (pkemctx->kem == NULL || pkemctx->kdf == NULL)
+        return 0;
+    n = pkemctx->recipients != NULL ? pkemctx->num_recipients : 1;
+    return OQSX_SCRATCH_ROUND(n * pkemctx->kem->kem_layout.secretlen);
+}
+
+static int oqs_kem_get_ctx_params(void *vpkemctx, OSSL_PARAM *params)
 {
-    const PROV_OQSKEM_CTX *pkemctx = (PROV_OQSKEM_CTX *)vpkemctx;
-    const OQS_KEM *kem_ctx = pkemctx->kem->oqsx_provider_ctx.oqsx_qs_ctx.kem;
+    PROV_OQSKEM_CTX *pkemctx = (PROV_OQSKEM_CTX *)vpkemctx;
+    OSSL_PARAM *p;
 
-    OQS_KEM_PRINTF("OQS KEM provider called: encaps\n");
-    if (pkemctx->kem == NULL) {
-        OQS_KEM_PRINTF("OQS Warning: OQS_KEM not initialized\n");
-        return -1;
-    }
-    *outlen = kem_ctx->length_ciphertext;
-    *secretlen = kem_ctx->length_shared_secret;
-    if (out == NULL || secret == NULL) {
-       OQS_KEM_PRINTF3("KEM returning lengths %ld and %ld\n", *outlen, *secretlen);
-       return 1;
-    }
-    return OQS_SUCCESS == OQS_KEM_encaps(kem_ctx, out, secret, pkemctx->kem->comp_pubkey[keyslot]);
+    OQS_KEM_PRINTF("OQS KEM provider called: get_ctx_params\n");
+    if (pkemctx == NULL)
+        return 0;
+
+    p = OSSL_PARAM_locate(params, OQS_PARAM_SCRATCH_SIZE);
+    if (p != NULL && !OSSL_PARAM_set_size_t(p, oqs_kem_scratch_size(pkemctx)))
+        return 0;
+
+    return 1;
 }
 
-static int oqs_qs_kem_decaps_keyslot(void *vpkemctx, unsigned char *out, size_t *outlen,
-                                     const unsigned char *in, size_t inlen, int keyslot)
+static const OSSL_PARAM oqs_kem_known_gettable_ctx_params[] = {
+    OSSL_PARAM_size_t(OQS_PARAM_SCRATCH_SIZE, NULL),
+    OSSL_PARAM_END
+};
+
+static const OSSL_PARAM *oqs_kem_gettable_ctx_params(ossl_unused void *vpkemctx,
+                                                     ossl_unused void *provctx)
 {
-    const PROV_OQSKEM_CTX *pkemctx = (PROV_OQSKEM_CTX *)vpkemctx;
-    const OQS_KEM *kem_ctx = pkemctx->kem->oqsx_provider_ctx.oqsx_qs_ctx.kem;
+    return oqs_kem_known_gettable_ctx_params;
+}
 
-    OQS_KEM_PRINTF("OQS KEM provider called: decaps\n");
-    if (pkemctx->kem == NULL) {
-        OQS_KEM_PRINTF("OQS Warning: OQS_KEM not initialized\n");
-        return -1;
-    }
-    *outlen = kem_ctx->length_shared_secret;
-    if (out == NULL) return 1;
+/* Sets up (or, given an empty name, drops) the HKDF for the given digest */
+static int oqs_kem_set_kdf(PROV_OQSKEM_CTX *pkemctx, const OSSL_PARAM *p)
+{
+    OSSL_PARAM kdfparams[2];
+    char mdname[OSSL_MAX_NAME_SIZE] = "", *pmdname = mdname;
+    EVP_KDF *kdf = NULL;
+    EVP_MD *md = NULL;
+    int ret = 0;
+
+    if (!OSSL_PARAM_get_utf8_string(p, &pmdname, sizeof(mdname)))
+        return 0;
+    EVP_KDF_CTX_free(pkemctx->kdf);
+    pkemctx->kdf = NULL;
+    pkemctx->kdf_len = 0;
+    if (mdname[0] == '\0')
+        return 1;
+
+    kdfparams[0] = OSSL_PARAM_construct_utf8_string(OSSL_KDF_PARAM_DIGEST, mdname, 0);
+    kdfparams[1] = OSSL_PARAM_construct_end();
+    if ((md = EVP_MD_fetch(pkemctx->libctx, mdname, NULL)) == NULL
+            || (kdf = EVP_KDF_fetch(pkemctx->libctx, OSSL_KDF_NAME_HKDF, NULL)) == NULL
+            || (pkemctx->kdf = EVP_KDF_CTX_new(kdf)) == NULL
+            || !EVP_KDF_CTX_set_params(pkemctx->kdf, kdfparams))
+        goto err;
+    pkemctx->kdf_len = EVP_MD_get_size(md);
+    ret = 1;
 
-    return OQS_SUCCESS == OQS_KEM_decaps(kem_ctx, out, in, pkemctx->kem->comp_privkey[keyslot]);
+    err:
+    if (!ret) {
+        EVP_KDF_CTX_free(pkemctx->kdf);
+        pkemctx->kdf = NULL;
+    }
+    EVP_KDF_free(kdf);
+    EVP_MD_free(md);
+    return ret;
 }
 
-static int oqs_qs_kem_encaps(void *vpkemctx, unsigned char *out, size_t *outlen,
-                             unsigned char *secret, size_t *secretlen)
+static int oqs_kem_set_ctx_params(void *vpkemctx, const OSSL_PARAM params[])
 {
-    return oqs_qs_kem_encaps_keyslot(vpkemctx, out, outlen, secret, secretlen, 0);
+    PROV_OQSKEM_CTX *pkemctx = (PROV_OQSKEM_CTX *)vpkemctx;
+    const OSSL_PARAM *p;
+
+    OQS_KEM_PRINTF("OQS KEM provider called: set_ctx_params\n");
+    if (pkemctx == NULL)
+        return 0;
+    if (params == NULL)
+        return 1;
+
+    p = OSSL_PARAM_locate_const(params, OQS_PARAM_SCRATCH);
+    if (p != NULL && !oqsx_scratch_set(&pkemctx->scratch, p))
+        return 0;
+
+    p = OSSL_PARAM_locate_const(params, OQS_PARAM_KEM_RECIPIENTS);
+    if (p != NULL) {
+        unsigned char *recipients = NULL;
+
+        if (p->data_type != OSSL_PARAM_OCTET_STRING || pkemctx->kem == NULL
+                || p->data_size % pkemctx->kem->pubkeylen != 0)
+            return 0;
+        if (p->data_size > 0
+                && (recipients = OPENSSL_memdup(p->data, p->data_size)) == NULL)
+            return 0;
+        OPENSSL_free(pkemctx->recipients);
+        pkemctx->recipients = recipients;
+        pkemctx->num_recipients = p->data_size / pkemctx->kem->pubkeylen;
+    }
+
+    // the digest (re)creates the KDF, so it goes before salt, info and length
+    p = OSSL_PARAM_locate_const(params, OQS_PARAM_KEM_KDF_DIGEST);
+    if (p != NULL && !oqs_kem_set_kdf(pkemctx, p))
+        return 0;
+    p = OSSL_PARAM_locate_const(params, OQS_PARAM_KEM_KDF_SALT);
+    if (p != NULL) {
+        OSSL_PARAM kdfparams[] = {
+            OSSL_PARAM_octet_string(OSSL_KDF_PARAM_SALT, p->data, p->data_size),
+            OSSL_PARAM_END
+        };
+
+        if (pkemctx->kdf == NULL || p->data_type != OSSL_PARAM_OCTET_STRING
+                || !EVP_KDF_CTX_set_params(pkemctx->kdf, kdfparams))
+            return 0;
+    }
+    p = OSSL_PARAM_locate_const(params, OQS_PARAM_KEM_KDF_INFO);
+    if (p != NULL) {
+        OSSL_PARAM kdfparams[] = {
+            OSSL_PARAM_octet_string(OSSL_KDF_PARAM_INFO, p->data, p->data_size),
+            OSSL_PARAM_END
+        };
+
+        if (pkemctx->kdf == NULL || p->data_type != OSSL_PARAM_OCTET_STRING
+                || !EVP_KDF_CTX_set_params(pkemctx->kdf, kdfparams))
+            return 0;
+    }
+    p = OSSL_PARAM_locate_const(params, OQS_PARAM_KEM_KDF_LEN);
+    if (p != NULL) {
+        size_t len;
+
+        if (pkemctx->kdf == NULL || !OSSL_PARAM_get_size_t(p, &len) || len == 0)
+            return 0;
+        pkemctx->kdf_len = len;
+    }
+
+    p = OSSL_PARAM_locate_const(params, OQS_PARAM_DEADLINE);
+    if (p != NULL && !OSSL_PARAM_get_uint64(p, &pkemctx->deadline))
+        return 0;
+
+    return 1;
 }
 
-static int oqs_qs_kem_decaps(void *vpkemctx, unsigned char *out, size_t *outlen,
-                             const unsigned char *in, size_t inlen)
+static const OSSL_PARAM oqs_kem_known_settable_ctx_params[] = {
+    OSSL_PARAM_octet_ptr(OQS_PARAM_SCRATCH, NULL, 0),
+    OSSL_PARAM_octet_string(OQS_PARAM_KEM_RECIPIENTS, NULL, 0),
+    OSSL_PARAM_utf8_string(OQS_PARAM_KEM_KDF_DIGEST, NULL, 0),
+    OSSL_PARAM_octet_string(OQS_PARAM_KEM_KDF_SALT, NULL, 0),
+    OSSL_PARAM_octet_string(OQS_PARAM_KEM_KDF_INFO, NULL, 0),
+    OSSL_PARAM_size_t(OQS_PARAM_KEM_KDF_LEN, NULL),
+    OSSL_PARAM_uint64(OQS_PARAM_DEADLINE, NULL),
+    OSSL_PARAM_END
+};
+
+static const OSSL_PARAM *oqs_kem_settable_ctx_params(ossl_unused void *vpkemctx,
+                                                     ossl_unused void *provctx)
 {
-    return oqs_qs_kem_decaps_keyslot(vpkemctx, out, outlen, in, inlen, 0);
+    return oqs_kem_known_settable_ctx_params;
 }
 
 /// EVP KEM functions
 
-static int oqs_evp_kem_encaps_keyslot(void *vpkemctx, unsigned char *ct, size_t *ctlen,
-                                      unsigned char *secret, size_t *secretlen, int keyslot)
+/*
+ * Classical component: the "ciphertext" is the encoded public key of an
+ * ephemeral keypair, the secret the ECDH/X25519/X448 derivation output.
+ */
+static int oqs_evp_kem_encaps_comp(const OQSX_EVP_CTX *evp_ctx,
+                                   unsigned char *ct, unsigned char *secret,
+                                   const unsigned char *pubkey_kex, int validated)
 {
     int ret = OQS_SUCCESS, ret2 = 0;
 
-    const PROV_OQSKEM_CTX *pkemctx = (PROV_OQSKEM_CTX *)vpkemctx;
-    const OQSX_EVP_CTX *evp_ctx = pkemctx->kem->oqsx_provider_ctx.oqsx_evp_ctx;
-
-    size_t pubkey_kexlen = 0;
-    size_t kexDeriveLen = 0, pkeylen = 0;
-    unsigned char *pubkey_kex = pkemctx->kem->comp_pubkey[keyslot];
+    size_t pubkey_kexlen = evp_ctx->kex_info->kex_length_public_key;
+    size_t kexDeriveLen = evp_ctx->kex_info->kex_length_secret;
+    size_t pkeylen = 0;
 
     // Free at err:
     EVP_PKEY_CTX *ctx = NULL, *kgctx = NULL;;
     EVP_PKEY *pkey = NULL, *peerpk = NULL;
-    unsigned char *ctkex_encoded = NULL;
-
-    pubkey_kexlen = evp_ctx->kex_info->kex_length_public_key;
-    kexDeriveLen = evp_ctx->kex_info->kex_length_secret;
 
-    *ctlen = pubkey_kexlen;
-    *secretlen = kexDeriveLen;
-
-    if (ct == NULL || secret == NULL) {
-        OQS_KEM_PRINTF3("EVP KEM returning lengths %ld and %ld\n", *ctlen, *secretlen);
-        return 1;
-    }
+    EVP_PKEY *kexParam = oqsx_evp_ctx_params(evp_ctx);
+    ON_ERR_SET_GOTO(!kexParam, ret, -1, err);
 
     peerpk = EVP_PKEY_new();
     ON_ERR_SET_GOTO(!peerpk, ret, -1, err);
 
-    ret2 = EVP_PKEY_copy_parameters(peerpk, evp_ctx->kexParam);
+    ret2 = EVP_PKEY_copy_parameters(peerpk, kexParam);
     ON_ERR_SET_GOTO(ret2 <= 0, ret, -1, err);
 
     ret2 = EVP_PKEY_set1_encoded_public_key(peerpk, pubkey_kex, pubkey_kexlen);
     ON_ERR_SET_GOTO(ret2 <= 0, ret, -1, err);
 
-    kgctx = EVP_PKEY_CTX_new(evp_ctx->kexParam, NULL);
+    kgctx = EVP_PKEY_CTX_new(kexParam, NULL);
     ON_ERR_SET_GOTO(!kgctx, ret, -1, err);
 
     ret2 = EVP_PKEY_keygen_init(kgctx);
@@ -200,59 +335,53 @@ static int oqs_evp_kem_encaps_keyslot(void *vpkemctx, unsigned char *ct, size_t
     ret = EVP_PKEY_derive_init(ctx);
     ON_ERR_SET_GOTO(ret <= 0, ret, -1, err);
 
-    ret = EVP_PKEY_derive_set_peer(ctx, peerpk);
+    // peers validated via oqsx_key_validate need no second public key check
+    ret = EVP_PKEY_derive_set_peer_ex(ctx, peerpk, !validated);
     ON_ERR_SET_GOTO(ret <= 0, ret, -1, err);
 
     ret = EVP_PKEY_derive(ctx, secret, &kexDeriveLen);
     ON_ERR_SET_GOTO(ret <= 0, ret, -1, err);
 
-    pkeylen = EVP_PKEY_get1_encoded_public_key(pkey, &ctkex_encoded);
-    ON_ERR_SET_GOTO(pkeylen <= 0 || !ctkex_encoded || pkeylen != pubkey_kexlen, ret, -1, err);
-
-    memcpy(ct, ctkex_encoded, pkeylen);
+    ret2 = EVP_PKEY_get_octet_string_param(pkey, OSSL_PKEY_PARAM_ENCODED_PUBLIC_KEY,
+                                           ct, pubkey_kexlen, &pkeylen);
+    ON_ERR_SET_GOTO(ret2 <= 0 || pkeylen != pubkey_kexlen, ret, -1, err);
 
     err:
     EVP_PKEY_CTX_free(ctx);
     EVP_PKEY_CTX_free(kgctx);
     EVP_PKEY_free(pkey);
     EVP_PKEY_free(peerpk);
-    OPENSSL_free(ctkex_encoded);
     return ret;
 }
 
-static int oqs_evp_kem_decaps_keyslot(void *vpkemctx, unsigned char *secret, size_t *secretlen,
-                                      const unsigned char *ct, size_t ctlen, int keyslot)
+static int oqs_evp_kem_decaps_comp(const OQSX_EVP_CTX *evp_ctx, unsigned char *secret,
+                                   const unsigned char *ct, const unsigned char *privkey_kex)
 {
-    OQS_KEM_PRINTF("OQS KEM provider called: oqs_hyb_kem_decaps\n");
-
     int ret = OQS_SUCCESS, ret2 = 0;
-    const PROV_OQSKEM_CTX *pkemctx = (PROV_OQSKEM_CTX *)vpkemctx;
-    const OQSX_EVP_CTX *evp_ctx = pkemctx->kem->oqsx_provider_ctx.oqsx_evp_ctx;
 
     size_t pubkey_kexlen = evp_ctx->kex_info->kex_length_public_key;
     size_t kexDeriveLen = evp_ctx->kex_info->kex_length_secret;
-    unsigned char *privkey_kex = pkemctx->kem->comp_privkey[keyslot];
     size_t privkey_kexlen = evp_ctx->kex_info->kex_length_private_key;
 
     // Free at err:
-    EVP_PKEY_CTX *ctx;
+    EVP_PKEY_CTX *ctx = NULL;
     EVP_PKEY *pkey = NULL, *peerpkey = NULL;
 
-    *secretlen = kexDeriveLen;
-    if (secret == NULL) return 1;
+    EVP_PKEY *kexParam = oqsx_evp_ctx_params(evp_ctx);
+    ON_ERR_SET_GOTO(!kexParam, ret, -11, err);
 
     if (evp_ctx->kex_info->raw_key_support) {
         pkey = EVP_PKEY_new_raw_private_key(evp_ctx->kex_info->nid_kex, NULL, privkey_kex, privkey_kexlen);
         ON_ERR_SET_GOTO(!pkey, ret, -10, err);
     } else {
-        pkey = d2i_AutoPrivateKey(&pkey, (const unsigned char **)&privkey_kex, privkey_kexlen);
+        pkey = d2i_AutoPrivateKey(&pkey, &privkey_kex, privkey_kexlen);
         ON_ERR_SET_GOTO(!pkey, ret, -2, err);
     }
 
     peerpkey = EVP_PKEY_new();
     ON_ERR_SET_GOTO(!peerpkey, ret, -3, err);
 
-    ret2 = EVP_PKEY_copy_parameters(peerpkey, evp_ctx->kexParam);
+    ret2 = EVP_PKEY_copy_parameters(peerpkey, kexParam);
     ON_ERR_SET_GOTO(ret2 <= 0, ret, -4, err);
 
     ret2 = EVP_PKEY_set1_encoded_public_key(peerpkey, ct, pubkey_kexlen);
@@ -276,83 +405,247 @@ static int oqs_evp_kem_decaps_keyslot(void *vpkemctx, unsigned char *secret, siz
     return ret;
 }
 
-/// Hybrid KEM functions
+/// Generic KEM functions
 
-static int oqs_hyb_kem_encaps(void *vpkemctx, unsigned char *ct, size_t *ctlen,
-                              unsigned char *secret, size_t *secretlen)
+/*
+ * Runs every component of the key's layout (see OQSX_KEM_LAYOUT) in one
+ * pass; plain KEMs are a layout with a single OQS component, hybrids start
+ * with their classical component.
+ */
+static int oqs_kem_encaps_pubkey(PROV_OQSKEM_CTX *pkemctx, unsigned char *ct, size_t *ctlen,
+                                 unsigned char *secret, size_t *secretlen,
+                                 const unsigned char *pubkey, int validated)
 {
-    int ret = OQS_SUCCESS;
-    const PROV_OQSKEM_CTX *pkemctx = (PROV_OQSKEM_CTX *)vpkemctx;
-    size_t secretLen0 = 0, secretLen1 = 0;
-    size_t ctLen0 = 0, ctLen1 = 0;
-    unsigned char *ct0, *ct1, *secret0, *secret1;
-
-    ret = oqs_evp_kem_encaps_keyslot(vpkemctx, NULL, &ctLen0, NULL, &secretLen0, 0);
-    ON_ERR_SET_GOTO(ret <= 0, ret, -1, err);
-    ret = oqs_qs_kem_encaps_keyslot(vpkemctx, NULL, &ctLen1, NULL, &secretLen1, 1);
-    ON_ERR_SET_GOTO(ret <= 0, ret, -1, err);
-
-    *ctlen = ctLen0 + ctLen1;
-    *secretlen = secretLen0 + secretLen1;
+    const OQSX_KEM_LAYOUT *layout;
+    const OQSX_KEM_COMP *comp;
+    size_t i;
+    int ret = 1;
 
+    OQS_KEM_PRINTF("OQS KEM provider called: encaps\n");
+    if (pkemctx->kem == NULL) {
+        OQS_KEM_PRINTF("OQS Warning: OQS_KEM not initialized\n");
+        return -1;
+    }
+    layout = &pkemctx->kem->kem_layout;
+    *ctlen = layout->ctlen;
+    *secretlen = layout->secretlen;
     if (ct == NULL || secret == NULL) {
-        OQS_KEM_PRINTF3("HYB KEM returning lengths %ld and %ld\n", *ctlen, *secretlen);
+        OQS_KEM_PRINTF3("KEM returning lengths %ld and %ld\n", *ctlen, *secretlen);
         return 1;
     }
 
-    ct0 = ct;
-    ct1 = ct + ctLen0;
-    secret0 = secret;
-    secret1 = secret + secretLen0;
+    for (i = 0; i < layout->numcomps && ret > 0; i++) {
+        comp = &layout->comps[i];
+        if (oqsx_deadline_passed(pkemctx->deadline))
+            ret = 0;
+        else if (comp->is_evp)
+            ret = oqs_evp_kem_encaps_comp(comp->ctx.evp, ct + comp->ct_off,
+                                          secret + comp->secret_off, pubkey + comp->pubkey_off,
+                                          validated);
+        else
+            ret = OQS_SUCCESS == pkemctx->kem->backend->kem_encaps(comp->ctx.kem, ct + comp->ct_off,
+                                                secret + comp->secret_off, pubkey + comp->pubkey_off);
+    }
+    if (ret <= 0)
+        OPENSSL_cleanse(secret, layout->secretlen);
+    return ret;
+}
 
-    ret = oqs_evp_kem_encaps_keyslot(vpkemctx, ct0, &ctLen0, secret0, &secretLen0, 0);
-    ON_ERR_SET_GOTO(ret <= 0, ret, -1, err);
+/*
+ * Encapsulates to every configured recipient public key in turn; ciphertexts
+ * and shared secrets are returned concatenated in recipient order.
+ */
+static int oqs_kem_encaps_recipients(PROV_OQSKEM_CTX *pkemctx, unsigned char *ct, size_t *ctlen,
+                                     unsigned char *secret, size_t *secretlen)
+{
+    const OQSX_KEM_LAYOUT *layout = &pkemctx->kem->kem_layout;
+    const unsigned char *pubkey = pkemctx->recipients;
+    size_t i, ctlen1, secretlen1;
+    int ret;
+
+    *ctlen = layout->ctlen * pkemctx->num_recipients;
+    *secretlen = layout->secretlen * pkemctx->num_recipients;
+    if (ct == NULL || secret == NULL)
+        return 1;
 
-    ret = oqs_qs_kem_encaps_keyslot(vpkemctx, ct1, &ctLen1, secret1, &secretLen1, 1);
-    ON_ERR_SET_GOTO(ret <= 0, ret, -1, err);
+    // plain KEM keys may leave all recipients to the backend at once
+    if (layout->numcomps == 1 && !layout->comps[0].is_evp
+            && pkemctx->kem->backend->kem_encaps_batch != NULL) {
+        if (oqsx_deadline_passed(pkemctx->deadline))
+            return 0;
+        if (OQS_SUCCESS == pkemctx->kem->backend->kem_encaps_batch(layout->comps[0].ctx.kem,
+                pkemctx->num_recipients, ct, secret, pubkey))
+            return 1;
+        OPENSSL_cleanse(secret, *secretlen);
+        return 0;
+    }
 
-    err:
+    for (i = 0; i < pkemctx->num_recipients; i++) {
+        ret = oqs_kem_encaps_pubkey(pkemctx, ct, &ctlen1, secret, &secretlen1, pubkey, 0);
+        if (ret <= 0) {
+            OPENSSL_cleanse(secret - i * layout->secretlen, *secretlen);
+            return ret;
+        }
+        ct += layout->ctlen;
+        secret += layout->secretlen;
+        pubkey += layout->pubkeylen;
+    }
+    return 1;
+}
+
+static int oqs_kem_encaps_raw(PROV_OQSKEM_CTX *pkemctx, unsigned char *ct, size_t *ctlen,
+                              unsigned char *secret, size_t *secretlen)
+{
+    OQSX_KEY_PIN pin;
+    uint64_t trace = oqsx_trace_begin();
+    int ret;
+
+    if (pkemctx->kem == NULL)
+        return -1;
+    // the context key only names the algorithm when recipients are set
+    if (pkemctx->recipients != NULL) {
+        ret = oqs_kem_encaps_recipients(pkemctx, ct, ctlen, secret, secretlen);
+    } else {
+        oqsx_key_pin(pkemctx->kem, &pin);
+        if (pin.pubkey == NULL)
+            ret = -1;
+        else
+            ret = oqs_kem_encaps_pubkey(pkemctx, ct, ctlen, secret, secretlen, pin.pubkey,
+                                        atomic_load(pin.validated) & OQSX_KEY_VALID_PUBLIC);
+        oqsx_key_unpin(pkemctx->kem, &pin);
+    }
+    if (ct != NULL)
+        oqsx_trace_end(trace, pkemctx->kem, OQSX_TRACE_OP_ENCAPS, 0, ret > 0 ? *ctlen : 0, ret > 0);
     return ret;
 }
 
-static int oqs_hyb_kem_decaps(void *vpkemctx, unsigned char *secret, size_t *secretlen,
-                              const unsigned char *ct, size_t ctlen)
+static int oqs_kem_decaps_raw(const PROV_OQSKEM_CTX *pkemctx, unsigned char *secret,
+                              size_t *secretlen, const unsigned char *ct, size_t ctlen)
 {
-    int ret = OQS_SUCCESS;
-    const PROV_OQSKEM_CTX *pkemctx = (PROV_OQSKEM_CTX *)vpkemctx;
-    const OQSX_EVP_CTX *evp_ctx = pkemctx->kem->oqsx_provider_ctx.oqsx_evp_ctx;
-    const OQS_KEM *qs_ctx = pkemctx->kem->oqsx_provider_ctx.oqsx_qs_ctx.kem;
+    const OQSX_KEM_LAYOUT *layout;
+    const OQSX_KEM_COMP *comp;
+    OQSX_KEY_PIN pin;
+    uint64_t trace = oqsx_trace_begin();
+    size_t i;
+    int ret = 1;
 
-    size_t secretLen0 = 0, secretLen1 = 0;
-    size_t ctLen0 = 0, ctLen1 = 0;
-    const unsigned char *ct0, *ct1;
-    unsigned char *secret0, *secret1;
+    OQS_KEM_PRINTF("OQS KEM provider called: decaps\n");
+    if (pkemctx->kem == NULL) {
+        OQS_KEM_PRINTF("OQS Warning: OQS_KEM not initialized\n");
+        return -1;
+    }
+    layout = &pkemctx->kem->kem_layout;
+    *secretlen = layout->secretlen;
+    if (secret == NULL) return 1;
 
-    ret = oqs_evp_kem_decaps_keyslot(vpkemctx, NULL, &secretLen0, NULL, 0, 0);
-    ON_ERR_SET_GOTO(ret <= 0, ret, -1, err);
-    ret = oqs_qs_kem_decaps_keyslot(vpkemctx, NULL, &secretLen1, NULL, 0, 1);
-    ON_ERR_SET_GOTO(ret <= 0, ret, -1, err);
+    ON_ERR_SET_GOTO(ctlen != layout->ctlen, ret, -1, err);
+    ON_ERR_SET_GOTO(pkemctx->kem->privkeylen != layout->privkeylen, ret, -1, err);
+
+    oqsx_key_pin(pkemctx->kem, &pin);
+    if (pin.privkey == NULL)
+        ret = -1;
+
+    for (i = 0; i < layout->numcomps && ret > 0; i++) {
+        comp = &layout->comps[i];
+        if (oqsx_deadline_passed(pkemctx->deadline))
+            ret = 0;
+        else if (comp->is_evp)
+            ret = oqs_evp_kem_decaps_comp(comp->ctx.evp, secret + comp->secret_off,
+                                          ct + comp->ct_off, pin.privkey + comp->privkey_off);
+        else
+            ret = OQS_SUCCESS == pkemctx->kem->backend->kem_decaps(comp->ctx.kem, secret + comp->secret_off,
+                                                ct + comp->ct_off, pin.privkey + comp->privkey_off);
+    }
+    oqsx_key_unpin(pkemctx->kem, &pin);
+    if (ret <= 0)
+        OPENSSL_cleanse(secret, layout->secretlen);
 
-    *secretlen = secretLen0 + secretLen1;
+    err:
+    oqsx_trace_end(trace, pkemctx->kem, OQSX_TRACE_OP_DECAPS, ctlen, 0, ret > 0);
+    return ret;
+}
 
-    if (secret == NULL) return 1;
+/*
+ * Derives the n secrets returned to the caller from n raw shared secrets of
+ * rawlen bytes each. HKDF keeps its own heap copy of the key, so that copy
+ * is replaced by an empty key (which wipes it) before returning; should that
+ * fail, the KDF context is reset, losing its settings rather than the secret.
+ */
+static int oqs_kem_kdf(const PROV_OQSKEM_CTX *pkemctx, unsigned char *secret,
+                       const unsigned char *raw, size_t rawlen, size_t n)
+{
+    OSSL_PARAM params[2];
+    size_t i;
+    int ret = 0;
+
+    params[1] = OSSL_PARAM_construct_end();
+    for (i = 0; i < n; i++) {
+        params[0] = OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_KEY,
+                                                      (void *)(raw + i * rawlen), rawlen);
+        if (EVP_KDF_derive(pkemctx->kdf, secret + i * pkemctx->kdf_len,
+                           pkemctx->kdf_len, params) <= 0)
+            goto err;
+    }
+    ret = 1;
+
+    err:
+    if (!ret)
+        OPENSSL_cleanse(secret, n * pkemctx->kdf_len);
+    params[0] = OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_KEY, (void *)"", 0);
+    if (!EVP_KDF_CTX_set_params(pkemctx->kdf, params))
+        EVP_KDF_CTX_reset(pkemctx->kdf);
+    return ret;
+}
 
-    ctLen0 = evp_ctx->kex_info->kex_length_public_key;
-    ctLen1 = qs_ctx->length_ciphertext;
+static int oqs_kem_encaps(void *vpkemctx, unsigned char *ct, size_t *ctlen,
+                          unsigned char *secret, size_t *secretlen)
+{
+    PROV_OQSKEM_CTX *pkemctx = (PROV_OQSKEM_CTX *)vpkemctx;
+    unsigned char *raw = NULL;
+    size_t n, rawlen, rawsize;
+    int ret;
 
-    ON_ERR_SET_GOTO(ctLen0 + ctLen1 != ctlen, ret, -1, err);
+    if (pkemctx->kdf == NULL || pkemctx->kem == NULL)
+        return oqs_kem_encaps_raw(pkemctx, ct, ctlen, secret, secretlen);
 
-    ct0 = ct;
-    ct1 = ct + ctLen0;
-    secret0 = secret;
-    secret1 = secret + secretLen0;
+    n = pkemctx->recipients != NULL ? pkemctx->num_recipients : 1;
+    if (ct == NULL || secret == NULL) {
+        ret = oqs_kem_encaps_raw(pkemctx, NULL, ctlen, NULL, &rawlen);
+        *secretlen = n * pkemctx->kdf_len;
+        return ret;
+    }
+    rawsize = rawlen = n * pkemctx->kem->kem_layout.secretlen;
+    if ((raw = oqsx_scratch_alloc(&pkemctx->scratch, rawsize)) == NULL)
+        return 0;
+    ret = oqs_kem_encaps_raw(pkemctx, ct, ctlen, raw, &rawlen);
+    if (ret > 0 && !oqs_kem_kdf(pkemctx, secret, raw, pkemctx->kem->kem_layout.secretlen, n))
+        ret = 0;
+    oqsx_scratch_free(&pkemctx->scratch, raw, rawsize);
+    *secretlen = n * pkemctx->kdf_len;
+    return ret;
+}
 
-    ret = oqs_evp_kem_decaps_keyslot(vpkemctx, secret0, &secretLen0, ct0, ctLen0, 0);
-    ON_ERR_SET_GOTO(ret <= 0, ret, -1, err);
-    ret = oqs_qs_kem_decaps_keyslot(vpkemctx, secret1, &secretLen1, ct1, ctLen1, 1);
-    ON_ERR_SET_GOTO(ret <= 0, ret, -1, err);
+static int oqs_kem_decaps(void *vpkemctx, unsigned char *secret, size_t *secretlen,
+                          const unsigned char *ct, size_t ctlen)
+{
+    PROV_OQSKEM_CTX *pkemctx = (PROV_OQSKEM_CTX *)vpkemctx;
+    unsigned char *raw = NULL;
+    size_t rawlen, rawsize;
+    int ret;
 
-    err:
+    if (pkemctx->kdf == NULL || pkemctx->kem == NULL)
+        return oqs_kem_decaps_raw(pkemctx, secret, secretlen, ct, ctlen);
+
+    *secretlen = pkemctx->kdf_len;
+    if (secret == NULL)
+        return 1;
+    rawsize = rawlen = pkemctx->kem->kem_layout.secretlen;
+    if ((raw = oqsx_scratch_alloc(&pkemctx->scratch, rawsize)) == NULL)
+        return 0;
+    ret = oqs_kem_decaps_raw(pkemctx, raw, &rawlen, ct, ctlen);
+    if (ret > 0 && !oqs_kem_kdf(pkemctx, secret, raw, rawsize, 1))
+        ret = 0;
+    oqsx_scratch_free(&pkemctx->scratch, raw, rawsize);
     return ret;
 }
 
@@ -360,10 +653,14 @@ static int oqs_hyb_kem_decaps(void *vpkemctx, unsigned char *secret, size_t *sec
     const OSSL_DISPATCH oqs_##alg##_kem_functions[] = { \
       { OSSL_FUNC_KEM_NEWCTX, (void (*)(void))oqs_kem_newctx }, \
       { OSSL_FUNC_KEM_ENCAPSULATE_INIT, (void (*)(void))oqs_kem_encaps_init }, \
-      { OSSL_FUNC_KEM_ENCAPSULATE, (void (*)(void))oqs_qs_kem_encaps }, \
+      { OSSL_FUNC_KEM_ENCAPSULATE, (void (*)(void))oqs_kem_encaps }, \
       { OSSL_FUNC_KEM_DECAPSULATE_INIT, (void (*)(void))oqs_kem_decaps_init }, \
-      { OSSL_FUNC_KEM_DECAPSULATE, (void (*)(void))oqs_qs_kem_decaps }, \
+      { OSSL_FUNC_KEM_DECAPSULATE, (void (*)(void))oqs_kem_decaps }, \
       { OSSL_FUNC_KEM_FREECTX, (void (*)(void))oqs_kem_freectx }, \
+      { OSSL_FUNC_KEM_GET_CTX_PARAMS, (void (*)(void))oqs_kem_get_ctx_params }, \
+      { OSSL_FUNC_KEM_GETTABLE_CTX_PARAMS, (void (*)(void))oqs_kem_gettable_ctx_params }, \
+      { OSSL_FUNC_KEM_SET_CTX_PARAMS, (void (*)(void))oqs_kem_set_ctx_params }, \
+      { OSSL_FUNC_KEM_SETTABLE_CTX_PARAMS, (void (*)(void))oqs_kem_settable_ctx_params }, \
       { 0, NULL } \
   };
 
@@ -371,10 +668,14 @@ static int oqs_hyb_kem_decaps(void *vpkemctx, unsigned char *secret, size_t *sec
     const OSSL_DISPATCH oqs_##alg##_kem_functions[] = { \
       { OSSL_FUNC_KEM_NEWCTX, (void (*)(void))oqs_kem_newctx }, \
       { OSSL_FUNC_KEM_ENCAPSULATE_INIT, (void (*)(void))oqs_kem_encaps_init }, \
-      { OSSL_FUNC_KEM_ENCAPSULATE, (void (*)(void))oqs_hyb_kem_encaps }, \
+      { OSSL_FUNC_KEM_ENCAPSULATE, (void (*)(void))oqs_kem_encaps }, \
       { OSSL_FUNC_KEM_DECAPSULATE_INIT, (void (*)(void))oqs_kem_decaps_init }, \
-      { OSSL_FUNC_KEM_DECAPSULATE, (void (*)(void))oqs_hyb_kem_decaps }, \
+      { OSSL_FUNC_KEM_DECAPSULATE, (void (*)(void))oqs_kem_decaps }, \
       { OSSL_FUNC_KEM_FREECTX, (void (*)(void))oqs_kem_freectx }, \
+      { OSSL_FUNC_KEM_GET_CTX_PARAMS, (void (*)(void))oqs_kem_get_ctx_params }, \
+      { OSSL_FUNC_KEM_GETTABLE_CTX_PARAMS, (void (*)(void))oqs_kem_gettable_ctx_params }, \
+      { OSSL_FUNC_KEM_SET_CTX_PARAMS, (void (*)(void))oqs_kem_set_ctx_params }, \
+      { OSSL_FUNC_KEM_SETTABLE_CTX_PARAMS, (void (*)(void))oqs_kem_settable_ctx_params }, \
       { 0, NULL } \
   };
 
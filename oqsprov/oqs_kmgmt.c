@@ -40,6 +40,7 @@ static OSSL_FUNC_keymgmt_gettable_params_fn oqs_gettable_params;
 static OSSL_FUNC_keymgmt_set_params_fn oqsx_set_params;
 static OSSL_FUNC_keymgmt_settable_params_fn oqsx_settable_params;
 static OSSL_FUNC_keymgmt_has_fn oqsx_has;
+static OSSL_FUNC_keymgmt_validate_fn oqsx_validate;
 static OSSL_FUNC_keymgmt_match_fn oqsx_match;
 static OSSL_FUNC_keymgmt_import_fn oqsx_import;
 static OSSL_FUNC_keymgmt_import_types_fn oqs_imexport_types;
@@ -47,17 +48,20 @@ static OSSL_FUNC_keymgmt_export_fn oqsx_export;
 static OSSL_FUNC_keymgmt_export_types_fn oqs_imexport_types;
 
 struct oqsx_gen_ctx {
+    PROV_OQS_CTX *provctx;
     OSSL_LIB_CTX *libctx;
     char *propq;
     char *oqs_name;
     char *tls_name;
     int primitive;
     int selection;
+    EVP_PKEY *classical_sibling;
 };
 
 static int oqsx_has(const void *keydata, int selection)
 {
-    const OQSX_KEY *key = keydata;
+    OQSX_KEY *key = (OQSX_KEY *)keydata;
+    OQSX_KEY_PIN pin;
     int ok = 0;
 
     OQS_KM_PRINTF("OQSKEYMGMT: has called\n");
@@ -68,47 +72,70 @@ static int oqsx_has(const void *keydata, int selection)
          */
         ok = 1;
 
+        oqsx_key_pin(key, &pin);
         if ((selection & OSSL_KEYMGMT_SELECT_PUBLIC_KEY) != 0)
-            ok = ok && key->pubkey != NULL;
+            ok = ok && pin.pubkey != NULL;
 
         if ((selection & OSSL_KEYMGMT_SELECT_PRIVATE_KEY) != 0)
-            ok = ok && key->privkey != NULL;
+            ok = ok && pin.privkey != NULL;
+        oqsx_key_unpin(key, &pin);
     }
     return ok;
 }
 
 static int oqsx_match(const void *keydata1, const void *keydata2, int selection)
 {
-    const OQSX_KEY *key1 = keydata1;
-    const OQSX_KEY *key2 = keydata2;
+    OQSX_KEY *key1 = (OQSX_KEY *)keydata1;
+    OQSX_KEY *key2 = (OQSX_KEY *)keydata2;
+    OQSX_KEY_PIN pin1, pin2;
     int ok = 1;
 
     OQS_KM_PRINTF("OQSKEYMGMT: match called\n");
 
+    oqsx_key_pin(key1, &pin1);
+    oqsx_key_pin(key2, &pin2);
     if ((selection & OSSL_KEYMGMT_SELECT_DOMAIN_PARAMETERS) != 0)
         ok = ok && !strcmp(key1->oqs_name, key2->oqs_name);
     if ((selection & OSSL_KEYMGMT_SELECT_PRIVATE_KEY) != 0) {
-        if ((key1->privkey == NULL && key2->privkey != NULL)
-                || (key1->privkey != NULL && key2->privkey == NULL)
+        if ((pin1.privkey == NULL && pin2.privkey != NULL)
+                || (pin1.privkey != NULL && pin2.privkey == NULL)
                 || strcmp(key1->oqs_name, key2->oqs_name))
             ok = 0;
         else
-            ok = ok && (key1->privkey == NULL /* implies key2->privkey == NULL */
-                        || CRYPTO_memcmp(key1->privkey, key2->privkey,
+            ok = ok && (pin1.privkey == NULL /* implies pin2.privkey == NULL */
+                        || CRYPTO_memcmp(pin1.privkey, pin2.privkey,
                                          key1->privkeylen) == 0);
     }
     if ((selection & OSSL_KEYMGMT_SELECT_PUBLIC_KEY) != 0) {
-        if ((key1->pubkey!=NULL && key2->pubkey != NULL)
+        if ((pin1.pubkey == NULL && pin2.pubkey != NULL)
+                || (pin1.pubkey != NULL && pin2.pubkey == NULL)
                 || strcmp(key1->oqs_name, key2->oqs_name))
             ok = 0;
         else
-            ok = ok && (key1->pubkey == NULL /* implies key2->haspubkey == NULL */
-                        || CRYPTO_memcmp(key1->pubkey, key2->pubkey,
+            ok = ok && (pin1.pubkey == NULL /* implies pin2.pubkey == NULL */
+                        || CRYPTO_memcmp(pin1.pubkey, pin2.pubkey,
                                          key1->pubkeylen) == 0);
     }
+    oqsx_key_unpin(key2, &pin2);
+    oqsx_key_unpin(key1, &pin1);
     return ok;
 }
 
+static int oqsx_validate(const void *keydata, int selection, int checktype)
+{
+    OQSX_KEY *key = (OQSX_KEY *)keydata;
+
+    OQS_KM_PRINTF("OQSKEYMGMT: validate called\n");
+    if (key == NULL) {
+        ERR_raise(ERR_LIB_USER, OQSPROV_UNEXPECTED_NULL);
+        return 0;
+    }
+    // parameters: OQSX keys have none (see oqsx_has)
+    if ((selection & OSSL_KEYMGMT_SELECT_KEYPAIR) == 0)
+        return 1;
+    return oqsx_key_validate(key, selection, checktype);
+}
+
 static int oqsx_import(void *keydata, int selection, const OSSL_PARAM params[])
 {
     OQSX_KEY *key = keydata;
@@ -133,6 +160,7 @@ static int oqsx_export(void *keydata, int selection, OSSL_CALLBACK *param_cb,
     OSSL_PARAM_BLD *tmpl;
     OSSL_PARAM *params = NULL;
     OSSL_PARAM *p;
+    OQSX_KEY_PIN pin;
     int ret = 0;
 
     OQS_KM_PRINTF("OQSKEYMGMT: export called\n");
@@ -149,14 +177,16 @@ static int oqsx_export(void *keydata, int selection, OSSL_CALLBACK *param_cb,
 
     if (((selection & OSSL_KEYMGMT_SELECT_ALL_PARAMETERS) != 0) ||
         ((selection & OSSL_KEYMGMT_SELECT_KEYPAIR) != 0)) {
-        if ((p = OSSL_PARAM_locate(params, OSSL_PKEY_PARAM_PUB_KEY)) != NULL) {
-            if (!OSSL_PARAM_set_octet_string(p, key->pubkey, key->pubkeylen))
-                goto err;
-        }
-        if ((p = OSSL_PARAM_locate(params, OSSL_PKEY_PARAM_PRIV_KEY)) != NULL) {
-            if (!OSSL_PARAM_set_octet_string(p, key->privkey, key->privkeylen))
-                goto err;
-        }
+        int ok = 1;
+
+        oqsx_key_pin(key, &pin);
+        if ((p = OSSL_PARAM_locate(params, OSSL_PKEY_PARAM_PUB_KEY)) != NULL)
+            ok = OSSL_PARAM_set_octet_string(p, pin.pubkey, key->pubkeylen);
+        if (ok && (p = OSSL_PARAM_locate(params, OSSL_PKEY_PARAM_PRIV_KEY)) != NULL)
+            ok = OSSL_PARAM_set_octet_string(p, pin.privkey, key->privkeylen);
+        oqsx_key_unpin(key, &pin);
+        if (!ok)
+            goto err;
     }
 
     params = OSSL_PARAM_BLD_to_param(tmpl);
@@ -189,7 +219,9 @@ static const OSSL_PARAM *oqs_imexport_types(int selection)
 static int oqsx_get_params(void *key, OSSL_PARAM params[])
 {
     OQSX_KEY *oqsxk = key;
+    OQSX_KEY_PIN pin;
     OSSL_PARAM *p;
+    int ret = 0;
 
     OQS_KM_PRINTF("OQSKEYMGMT: get_params called\n");
     if ((p = OSSL_PARAM_locate(params, OSSL_PKEY_PARAM_BITS)) != NULL
@@ -201,20 +233,25 @@ static int oqsx_get_params(void *key, OSSL_PARAM params[])
     if ((p = OSSL_PARAM_locate(params, OSSL_PKEY_PARAM_MAX_SIZE)) != NULL
         && !OSSL_PARAM_set_int(p, oqsx_key_maxsize(oqsxk)))
         return 0;
+
+    oqsx_key_pin(oqsxk, &pin);
     if ((p = OSSL_PARAM_locate(params, OSSL_PKEY_PARAM_ENCODED_PUBLIC_KEY)) != NULL) {
-        if (!OSSL_PARAM_set_octet_string(p, oqsxk->pubkey, oqsxk->pubkeylen))
-            return 0;
+        if (!OSSL_PARAM_set_octet_string(p, pin.pubkey, oqsxk->pubkeylen))
+            goto err;
     }
     if ((p = OSSL_PARAM_locate(params, OSSL_PKEY_PARAM_PUB_KEY)) != NULL) {
-        if (!OSSL_PARAM_set_octet_string(p, oqsxk->pubkey, oqsxk->pubkeylen))
-            return 0;
+        if (!OSSL_PARAM_set_octet_string(p, pin.pubkey, oqsxk->pubkeylen))
+            goto err;
     }
     if ((p = OSSL_PARAM_locate(params, OSSL_PKEY_PARAM_PRIV_KEY)) != NULL) {
-        if (!OSSL_PARAM_set_octet_string(p, oqsxk->privkey, oqsxk->privkeylen))
-            return 0;
+        if (!OSSL_PARAM_set_octet_string(p, pin.privkey, oqsxk->privkeylen))
+            goto err;
     }
+    ret = 1;
 
-    return 1;
+    err:
+    oqsx_key_unpin(oqsxk, &pin);
+    return ret;
 }
 
 static const OSSL_PARAM oqsx_gettable_params[] = {
@@ -250,19 +287,22 @@ static int set_property_query(OQSX_KEY *oqsxkey, const char *propq)
 static int oqsx_set_params(void *key, const OSSL_PARAM params[])
 {
     OQSX_KEY *oqsxkey = key;
-    const OSSL_PARAM *p;
+    const OSSL_PARAM *p, *p2;
 
     OQS_KM_PRINTF("OQSKEYMGMT: set_params called\n");
     p = OSSL_PARAM_locate_const(params, OSSL_PKEY_PARAM_ENCODED_PUBLIC_KEY);
     if (p != NULL) {
         size_t used_len;
-        if (p->data_size != oqsxkey->pubkeylen
+        // rotated keys only take new material through oqsx_key_rotate
+        if (atomic_load(&oqsxkey->body) != NULL
+                || p->data_size != oqsxkey->pubkeylen
                 || !OSSL_PARAM_get_octet_string(p, &oqsxkey->pubkey, oqsxkey->pubkeylen,
                                                 &used_len)) {
             return 0;
         }
-        OPENSSL_clear_free(oqsxkey->privkey, oqsxkey->privkeylen);
+        oqsx_arena_clear_free(oqsxkey->privkey, oqsxkey->privkeylen);
         oqsxkey->privkey = NULL;
+        oqsx_key_set_validated(oqsxkey, 0);
     }
     p = OSSL_PARAM_locate_const(params, OSSL_PKEY_PARAM_PROPERTIES);
     if (p != NULL) {
@@ -271,6 +311,23 @@ static int oqsx_set_params(void *key, const OSSL_PARAM params[])
             return 0;
         }
     }
+    p = OSSL_PARAM_locate_const(params, OQS_PARAM_ROTATE_PRIV_KEY);
+    p2 = OSSL_PARAM_locate_const(params, OQS_PARAM_ROTATE_PUB_KEY);
+    if (p != NULL || p2 != NULL) {
+        OQSX_KEY_PIN pin;
+        int has_priv;
+
+        oqsx_key_pin(oqsxkey, &pin);
+        has_priv = pin.privkey != NULL;
+        oqsx_key_unpin(oqsxkey, &pin);
+        if (p == NULL || p2 == NULL
+            || p->data_type != OSSL_PARAM_OCTET_STRING
+            || p2->data_type != OSSL_PARAM_OCTET_STRING
+            || !has_priv
+            || !oqsx_key_rotate(oqsxkey, p->data, p->data_size, p2->data, p2->data_size)) {
+            return 0;
+        }
+    }
 
     return 1;
 }
@@ -278,6 +335,8 @@ static int oqsx_set_params(void *key, const OSSL_PARAM params[])
 static const OSSL_PARAM oqs_settable_params[] = {
     OSSL_PARAM_octet_string(OSSL_PKEY_PARAM_ENCODED_PUBLIC_KEY, NULL, 0),
     OSSL_PARAM_utf8_string(OSSL_PKEY_PARAM_PROPERTIES, NULL, 0),
+    OSSL_PARAM_octet_string(OQS_PARAM_ROTATE_PRIV_KEY, NULL, 0),
+    OSSL_PARAM_octet_string(OQS_PARAM_ROTATE_PUB_KEY, NULL, 0),
     OSSL_PARAM_END
 };
 
@@ -287,7 +346,7 @@ static const OSSL_PARAM *oqsx_settable_params(void *provctx)
     return oqs_settable_params;
 }
 
-static void *oqsx_gen_init(void *provctx, int selection, char* oqs_name, int primitive)
+static void *oqsx_gen_init(void *provctx, int selection, char* oqs_name, char* tls_name, int primitive)
 {
     OSSL_LIB_CTX *libctx = PROV_OQS_LIBCTX_OF(provctx);
     struct oqsx_gen_ctx *gctx = NULL;
@@ -295,8 +354,10 @@ static void *oqsx_gen_init(void *provctx, int selection, char* oqs_name, int pri
     OQS_KM_PRINTF2("OQSKEYMGMT: gen_init called for key %s\n", oqs_name);
 
     if ((gctx = OPENSSL_zalloc(sizeof(*gctx))) != NULL) {
+        gctx->provctx = provctx;
         gctx->libctx = libctx;
         gctx->oqs_name = OPENSSL_strdup(oqs_name);
+        gctx->tls_name = OPENSSL_strdup(tls_name);
         gctx->primitive = primitive;
         gctx->selection = selection;
     }
@@ -306,19 +367,37 @@ static void *oqsx_gen_init(void *provctx, int selection, char* oqs_name, int pri
 static void *oqsx_genkey(struct oqsx_gen_ctx *gctx)
 {
     OQSX_KEY *key;
+    uint64_t trace = oqsx_trace_begin();
+    int reuse;
 
     OQS_KM_PRINTF2("OQSKEYMGMT: gen called for %s\n", gctx->oqs_name);
     if (gctx == NULL)
         return NULL;
-    if ((key = oqsx_key_new(gctx->libctx, gctx->oqs_name, NULL, gctx->primitive, gctx->propq)) == NULL) {
+    // only keypairs are reused, never those tied to a sibling or properties
+    reuse = (gctx->selection & OSSL_KEYMGMT_SELECT_KEYPAIR) == OSSL_KEYMGMT_SELECT_KEYPAIR
+            && gctx->classical_sibling == NULL && gctx->propq == NULL;
+    if (reuse && (key = oqsx_reuse_get(gctx->provctx, gctx->primitive, gctx->tls_name)) != NULL)
+        return key;
+    if ((key = oqsx_key_new(gctx->libctx, gctx->oqs_name, gctx->tls_name, gctx->primitive, gctx->propq)) == NULL) {
         ERR_raise(ERR_LIB_PROV, ERR_R_MALLOC_FAILURE);
         return NULL;
     }
 
-    if (oqsx_key_gen(key)) {
+    if (gctx->classical_sibling != NULL
+            && gctx->primitive != KEY_TYPE_ECP_HYB_KEM && gctx->primitive != KEY_TYPE_ECX_HYB_KEM) {
        ERR_raise(ERR_LIB_USER, OQSPROV_UNEXPECTED_NULL);
+       oqsx_key_free(key);
        return NULL;
     }
+    if (oqsx_key_gen_shared(key, gctx->classical_sibling)) {
+       ERR_raise(ERR_LIB_USER, OQSPROV_UNEXPECTED_NULL);
+       oqsx_trace_end(trace, key, OQSX_TRACE_OP_KEYGEN, 0, 0, 0);
+       oqsx_key_free(key);
+       return NULL;
+    }
+    oqsx_trace_end(trace, key, OQSX_TRACE_OP_KEYGEN, 0, key->pubkeylen, 1);
+    if (reuse)
+        oqsx_reuse_put(gctx->provctx, key);
     return key;
 }
 
@@ -336,7 +415,10 @@ static void oqsx_gen_cleanup(void *genctx)
     struct oqsx_gen_ctx *gctx = genctx;
 
     OQS_KM_PRINTF("OQSKEYMGMT: gen_cleanup called\n");
+    EVP_PKEY_free(gctx->classical_sibling);
     OPENSSL_free(gctx->propq);
+    OPENSSL_free(gctx->tls_name);
+    OPENSSL_free(gctx->oqs_name);
     OPENSSL_free(gctx);
 }
 
@@ -360,6 +442,7 @@ static const OSSL_PARAM *oqsx_gen_settable_params(void *provctx)
     static OSSL_PARAM settable[] = {
         OSSL_PARAM_utf8_string(OSSL_PKEY_PARAM_GROUP_NAME, NULL, 0),
         OSSL_PARAM_utf8_string(OSSL_KDF_PARAM_PROPERTIES, NULL, 0),
+        OSSL_PARAM_octet_ptr(OQS_PARAM_CLASSICAL_SIBLING, NULL, 0),
         OSSL_PARAM_END
     };
     return settable;
@@ -378,6 +461,7 @@ static int oqsx_gen_set_params(void *genctx, const OSSL_PARAM params[])
     if (p != NULL) {
         const char *algname = (char*)p->data;
 
+        OPENSSL_free(gctx->tls_name);
         gctx->tls_name = OPENSSL_strdup(algname);
     }
     p = OSSL_PARAM_locate_const(params, OSSL_KDF_PARAM_PROPERTIES);
@@ -389,6 +473,18 @@ static int oqsx_gen_set_params(void *genctx, const OSSL_PARAM params[])
         if (gctx->propq == NULL)
             return 0;
     }
+    p = OSSL_PARAM_locate_const(params, OQS_PARAM_CLASSICAL_SIBLING);
+    if (p != NULL) {
+        const void *sibling = NULL;
+        size_t used_len;
+
+        if (!OSSL_PARAM_get_octet_ptr(p, &sibling, &used_len))
+            return 0;
+        if (sibling != NULL && !EVP_PKEY_up_ref((EVP_PKEY *)sibling))
+            return 0;
+        EVP_PKEY_free(gctx->classical_sibling);
+        gctx->classical_sibling = (EVP_PKEY *)sibling;
+    }
     return 1;
 }
 
@@ -401,7 +497,7 @@ static void *oqs_sig_default_new_key(void *provctx)
 
 static void *oqs_sig_default_gen_init(void *provctx, int selection)
 {
-    return oqsx_gen_init(provctx, selection, OQS_SIG_alg_default, 0);
+    return oqsx_gen_init(provctx, selection, OQS_SIG_alg_default, "oqs_sig_default", 0);
 }
 
 static void *dilithium2_new_key(void *provctx)
@@ -411,7 +507,7 @@ static void *dilithium2_new_key(void *provctx)
 
 static void *dilithium2_gen_init(void *provctx, int selection)
 {
-    return oqsx_gen_init(provctx, selection, OQS_SIG_alg_dilithium_2, 0);
+    return oqsx_gen_init(provctx, selection, OQS_SIG_alg_dilithium_2, "dilithium2", 0);
 }
 static void *dilithium3_new_key(void *provctx)
 {
@@ -420,7 +516,7 @@ static void *dilithium3_new_key(void *provctx)
 
 static void *dilithium3_gen_init(void *provctx, int selection)
 {
-    return oqsx_gen_init(provctx, selection, OQS_SIG_alg_dilithium_3, 0);
+    return oqsx_gen_init(provctx, selection, OQS_SIG_alg_dilithium_3, "dilithium3", 0);
 }
 static void *dilithium5_new_key(void *provctx)
 {
@@ -429,7 +525,7 @@ static void *dilithium5_new_key(void *provctx)
 
 static void *dilithium5_gen_init(void *provctx, int selection)
 {
-    return oqsx_gen_init(provctx, selection, OQS_SIG_alg_dilithium_5, 0);
+    return oqsx_gen_init(provctx, selection, OQS_SIG_alg_dilithium_5, "dilithium5", 0);
 }
 static void *dilithium2_aes_new_key(void *provctx)
 {
@@ -438,7 +534,7 @@ static void *dilithium2_aes_new_key(void *provctx)
 
 static void *dilithium2_aes_gen_init(void *provctx, int selection)
 {
-    return oqsx_gen_init(provctx, selection, OQS_SIG_alg_dilithium_2_aes, 0);
+    return oqsx_gen_init(provctx, selection, OQS_SIG_alg_dilithium_2_aes, "dilithium2_aes", 0);
 }
 static void *dilithium3_aes_new_key(void *provctx)
 {
@@ -447,7 +543,7 @@ static void *dilithium3_aes_new_key(void *provctx)
 
 static void *dilithium3_aes_gen_init(void *provctx, int selection)
 {
-    return oqsx_gen_init(provctx, selection, OQS_SIG_alg_dilithium_3_aes, 0);
+    return oqsx_gen_init(provctx, selection, OQS_SIG_alg_dilithium_3_aes, "dilithium3_aes", 0);
 }
 static void *dilithium5_aes_new_key(void *provctx)
 {
@@ -456,7 +552,7 @@ static void *dilithium5_aes_new_key(void *provctx)
 
 static void *dilithium5_aes_gen_init(void *provctx, int selection)
 {
-    return oqsx_gen_init(provctx, selection, OQS_SIG_alg_dilithium_5_aes, 0);
+    return oqsx_gen_init(provctx, selection, OQS_SIG_alg_dilithium_5_aes, "dilithium5_aes", 0);
 }
 
 static void *falcon512_new_key(void *provctx)
@@ -466,7 +562,7 @@ static void *falcon512_new_key(void *provctx)
 
 static void *falcon512_gen_init(void *provctx, int selection)
 {
-    return oqsx_gen_init(provctx, selection, OQS_SIG_alg_falcon_512, 0);
+    return oqsx_gen_init(provctx, selection, OQS_SIG_alg_falcon_512, "falcon512", 0);
 }
 static void *falcon1024_new_key(void *provctx)
 {
@@ -475,7 +571,7 @@ static void *falcon1024_new_key(void *provctx)
 
 static void *falcon1024_gen_init(void *provctx, int selection)
 {
-    return oqsx_gen_init(provctx, selection, OQS_SIG_alg_falcon_1024, 0);
+    return oqsx_gen_init(provctx, selection, OQS_SIG_alg_falcon_1024, "falcon1024", 0);
 }
 
 static void *picnicl1full_new_key(void *provctx)
@@ -485,7 +581,7 @@ static void *picnicl1full_new_key(void *provctx)
 
 static void *picnicl1full_gen_init(void *provctx, int selection)
 {
-    return oqsx_gen_init(provctx, selection, OQS_SIG_alg_picnic_L1_full, 0);
+    return oqsx_gen_init(provctx, selection, OQS_SIG_alg_picnic_L1_full, "picnicl1full", 0);
 }
 static void *picnic3l1_new_key(void *provctx)
 {
@@ -494,7 +590,7 @@ static void *picnic3l1_new_key(void *provctx)
 
 static void *picnic3l1_gen_init(void *provctx, int selection)
 {
-    return oqsx_gen_init(provctx, selection, OQS_SIG_alg_picnic3_L1, 0);
+    return oqsx_gen_init(provctx, selection, OQS_SIG_alg_picnic3_L1, "picnic3l1", 0);
 }
 
 static void *rainbowIclassic_new_key(void *provctx)
@@ -504,7 +600,7 @@ static void *rainbowIclassic_new_key(void *provctx)
 
 static void *rainbowIclassic_gen_init(void *provctx, int selection)
 {
-    return oqsx_gen_init(provctx, selection, OQS_SIG_alg_rainbow_I_classic, 0);
+    return oqsx_gen_init(provctx, selection, OQS_SIG_alg_rainbow_I_classic, "rainbowIclassic", 0);
 }
 static void *rainbowVclassic_new_key(void *provctx)
 {
@@ -513,7 +609,7 @@ static void *rainbowVclassic_new_key(void *provctx)
 
 static void *rainbowVclassic_gen_init(void *provctx, int selection)
 {
-    return oqsx_gen_init(provctx, selection, OQS_SIG_alg_rainbow_V_classic, 0);
+    return oqsx_gen_init(provctx, selection, OQS_SIG_alg_rainbow_V_classic, "rainbowVclassic", 0);
 }
 
 static void *sphincsharaka128frobust_new_key(void *provctx)
@@ -523,7 +619,7 @@ static void *sphincsharaka128frobust_new_key(void *provctx)
 
 static void *sphincsharaka128frobust_gen_init(void *provctx, int selection)
 {
-    return oqsx_gen_init(provctx, selection, OQS_SIG_alg_sphincs_haraka_128f_robust, 0);
+    return oqsx_gen_init(provctx, selection, OQS_SIG_alg_sphincs_haraka_128f_robust, "sphincsharaka128frobust", 0);
 }
 
 static void *sphincssha256128frobust_new_key(void *provctx)
@@ -533,7 +629,7 @@ static void *sphincssha256128frobust_new_key(void *provctx)
 
 static void *sphincssha256128frobust_gen_init(void *provctx, int selection)
 {
-    return oqsx_gen_init(provctx, selection, OQS_SIG_alg_sphincs_sha256_128f_robust, 0);
+    return oqsx_gen_init(provctx, selection, OQS_SIG_alg_sphincs_sha256_128f_robust, "sphincssha256128frobust", 0);
 }
 
 static void *sphincsshake256128frobust_new_key(void *provctx)
@@ -543,7 +639,7 @@ static void *sphincsshake256128frobust_new_key(void *provctx)
 
 static void *sphincsshake256128frobust_gen_init(void *provctx, int selection)
 {
-    return oqsx_gen_init(provctx, selection, OQS_SIG_alg_sphincs_shake256_128f_robust, 0);
+    return oqsx_gen_init(provctx, selection, OQS_SIG_alg_sphincs_shake256_128f_robust, "sphincsshake256128frobust", 0);
 }
 
 ///// OQS_TEMPLATE_FRAGMENT_KEYMGMT_CONSTRUCTORS_END
@@ -558,6 +654,7 @@ static void *sphincsshake256128frobust_gen_init(void *provctx, int selection)
         { OSSL_FUNC_KEYMGMT_GETTABLE_PARAMS, (void (*) (void))oqs_gettable_params }, \
         { OSSL_FUNC_KEYMGMT_SET_PARAMS, (void (*) (void))oqsx_set_params }, \
         { OSSL_FUNC_KEYMGMT_HAS, (void (*)(void))oqsx_has }, \
+        { OSSL_FUNC_KEYMGMT_VALIDATE, (void (*)(void))oqsx_validate }, \
         { OSSL_FUNC_KEYMGMT_MATCH, (void (*)(void))oqsx_match }, \
         { OSSL_FUNC_KEYMGMT_IMPORT, (void (*)(void))oqsx_import }, \
         { OSSL_FUNC_KEYMGMT_IMPORT_TYPES, (void (*)(void))oqs_imexport_types }, \
@@ -581,7 +678,7 @@ static void *sphincsshake256128frobust_gen_init(void *provctx, int selection)
                                                       \
     static void *tokalg##_gen_init(void *provctx, int selection) \
     { \
-        return oqsx_gen_init(provctx, selection, tokoqsalg, KEY_TYPE_KEM); \
+        return oqsx_gen_init(provctx, selection, tokoqsalg, "" #tokalg "", KEY_TYPE_KEM); \
     }                                                 \
                                                       \
     const OSSL_DISPATCH oqs_##tokalg##_keymgmt_functions[] = { \
@@ -592,6 +689,7 @@ static void *sphincsshake256128frobust_gen_init(void *provctx, int selection)
         { OSSL_FUNC_KEYMGMT_GETTABLE_PARAMS, (void (*) (void))oqs_gettable_params }, \
         { OSSL_FUNC_KEYMGMT_SET_PARAMS, (void (*) (void))oqsx_set_params }, \
         { OSSL_FUNC_KEYMGMT_HAS, (void (*)(void))oqsx_has }, \
+        { OSSL_FUNC_KEYMGMT_VALIDATE, (void (*)(void))oqsx_validate }, \
         { OSSL_FUNC_KEYMGMT_MATCH, (void (*)(void))oqsx_match }, \
         { OSSL_FUNC_KEYMGMT_IMPORT, (void (*)(void))oqsx_import }, \
         { OSSL_FUNC_KEYMGMT_IMPORT_TYPES, (void (*)(void))oqs_imexport_types }, \
@@ -613,7 +711,7 @@ static void *sphincsshake256128frobust_gen_init(void *provctx, int selection)
                                                       \
     static void *ecp_##tokalg##_gen_init(void *provctx, int selection) \
     { \
-        return oqsx_gen_init(provctx, selection, tokoqsalg, KEY_TYPE_ECP_HYB_KEM); \
+        return oqsx_gen_init(provctx, selection, tokoqsalg, "" #tokalg "", KEY_TYPE_ECP_HYB_KEM); \
     } \
                                                       \
     const OSSL_DISPATCH oqs_ecp_##tokalg##_keymgmt_functions[] = { \
@@ -624,6 +722,7 @@ static void *sphincsshake256128frobust_gen_init(void *provctx, int selection)
         { OSSL_FUNC_KEYMGMT_GETTABLE_PARAMS, (void (*) (void))oqs_gettable_params }, \
         { OSSL_FUNC_KEYMGMT_SET_PARAMS, (void (*) (void))oqsx_set_params }, \
         { OSSL_FUNC_KEYMGMT_HAS, (void (*)(void))oqsx_has }, \
+        { OSSL_FUNC_KEYMGMT_VALIDATE, (void (*)(void))oqsx_validate }, \
         { OSSL_FUNC_KEYMGMT_MATCH, (void (*)(void))oqsx_match }, \
         { OSSL_FUNC_KEYMGMT_IMPORT, (void (*)(void))oqsx_import }, \
         { OSSL_FUNC_KEYMGMT_IMPORT_TYPES, (void (*)(void))oqs_imexport_types }, \
@@ -645,7 +744,7 @@ static void *sphincsshake256128frobust_gen_init(void *provctx, int selection)
                                                       \
     static void *ecx_##tokalg##_gen_init(void *provctx, int selection) \
     { \
-        return oqsx_gen_init(provctx, selection, tokoqsalg, KEY_TYPE_ECX_HYB_KEM); \
+        return oqsx_gen_init(provctx, selection, tokoqsalg, "" #tokalg "", KEY_TYPE_ECX_HYB_KEM); \
     } \
                                                       \
     const OSSL_DISPATCH oqs_ecx_##tokalg##_keymgmt_functions[] = { \
@@ -656,6 +755,7 @@ static void *sphincsshake256128frobust_gen_init(void *provctx, int selection)
         { OSSL_FUNC_KEYMGMT_GETTABLE_PARAMS, (void (*) (void))oqs_gettable_params }, \
         { OSSL_FUNC_KEYMGMT_SET_PARAMS, (void (*) (void))oqsx_set_params }, \
         { OSSL_FUNC_KEYMGMT_HAS, (void (*)(void))oqsx_has }, \
+        { OSSL_FUNC_KEYMGMT_VALIDATE, (void (*)(void))oqsx_validate }, \
         { OSSL_FUNC_KEYMGMT_MATCH, (void (*)(void))oqsx_match }, \
         { OSSL_FUNC_KEYMGMT_IMPORT, (void (*)(void))oqsx_import }, \
         { OSSL_FUNC_KEYMGMT_IMPORT_TYPES, (void (*)(void))oqs_imexport_types }, \
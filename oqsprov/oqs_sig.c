@@ -7,6 +7,28 @@
  * 
  * ToDo:  Go beyone EVP use cases/testing
  *
+ * ToDo:  Offline/online signing (pooling message-independent work such as
+ * Dilithium's y and w = Ay or Picnic's MPC preprocessing per key) needs a
+ * split sign API in liboqs; OQS_SIG_sign is one-shot, so there is nothing
+ * to precompute at this layer yet.
+ *
+ * ToDo:  Per-key caching of the SPHINCS+ top hypertree layer(s), which are
+ * identical for all signatures of a key, needs liboqs to accept such a
+ * cache in its sign call; until then every signature recomputes them.
+ *
+ * ToDo:  Batched (multi-buffer) finalisation of DigestSign/DigestVerify
+ * contexts. The digest state lives in an EVP_MD_CTX of a digest fetched
+ * from whichever provider implements it, so it is opaque here and cannot be
+ * moved into lanes of a multi-buffer SHA-2/SHAKE kernel; the core also
+ * hands us one context per final call, leaving no batch to coalesce
+ * without delaying each caller.
+ *
+ * ToDo:  Multi-key verification in SIMD lanes (4/8 independent Dilithium
+ * or Falcon verifications sharing NTT/SHAKE/norm-check passes) has to be
+ * written inside liboqs' algorithm implementations; OQS_SIG_verify takes
+ * a single key and signature, and the OpenSSL signature interface has no
+ * multi-verify operation to expose it through.
+ *
  * Significant hurdle: Signature providers of new algorithms are not utilized 
  * properly in OpenSSL3 yet -> Integration won't be seamless and probably 
  * requires quite some (upstream) OpenSSL3 dev investment.
@@ -71,58 +93,58 @@ static OSSL_FUNC_signature_set_ctx_md_params_fn oqs_sig_set_ctx_md_params;
 static OSSL_FUNC_signature_settable_ctx_md_params_fn oqs_sig_settable_ctx_md_params;
 
 // OIDS:
-static int get_oqs_oid(unsigned char* oidbuf, const char *oqs_name) {
+const char *oqsx_sig_oid(const char *oqs_name) {
 ///// OQS_TEMPLATE_FRAGMENT_SIG_OIDS_START
    if (!strcmp(OQS_SIG_alg_default, oqs_name))
-       return i2d_ASN1_OBJECT(OBJ_txt2obj("1.3.9999.1.1", 1), &oidbuf);
+       return "1.3.9999.1.1";
    else
    if (!strcmp(OQS_SIG_alg_dilithium_2, oqs_name))
-       return i2d_ASN1_OBJECT(OBJ_txt2obj("1.3.6.1.4.1.2.267.7.4.4", 1), &oidbuf);
+       return "1.3.6.1.4.1.2.267.7.4.4";
    else
    if (!strcmp(OQS_SIG_alg_dilithium_3, oqs_name))
-       return i2d_ASN1_OBJECT(OBJ_txt2obj("1.3.6.1.4.1.2.267.7.6.5", 1), &oidbuf);
+       return "1.3.6.1.4.1.2.267.7.6.5";
    else
    if (!strcmp(OQS_SIG_alg_dilithium_5, oqs_name))
-       return i2d_ASN1_OBJECT(OBJ_txt2obj("1.3.6.1.4.1.2.267.7.8.7", 1), &oidbuf);
+       return "1.3.6.1.4.1.2.267.7.8.7";
    else
    if (!strcmp(OQS_SIG_alg_dilithium_2_aes, oqs_name))
-       return i2d_ASN1_OBJECT(OBJ_txt2obj("1.3.6.1.4.1.2.267.11.4.4", 1), &oidbuf);
+       return "1.3.6.1.4.1.2.267.11.4.4";
    else
    if (!strcmp(OQS_SIG_alg_dilithium_3_aes, oqs_name))
-       return i2d_ASN1_OBJECT(OBJ_txt2obj("1.3.6.1.4.1.2.267.11.6.5", 1), &oidbuf);
+       return "1.3.6.1.4.1.2.267.11.6.5";
    else
    if (!strcmp(OQS_SIG_alg_dilithium_5_aes, oqs_name))
-       return i2d_ASN1_OBJECT(OBJ_txt2obj("1.3.6.1.4.1.2.267.11.8.7", 1), &oidbuf);
+       return "1.3.6.1.4.1.2.267.11.8.7";
    else
    if (!strcmp(OQS_SIG_alg_falcon_512, oqs_name))
-       return i2d_ASN1_OBJECT(OBJ_txt2obj("1.3.9999.3.1", 1), &oidbuf);
+       return "1.3.9999.3.1";
    else
    if (!strcmp(OQS_SIG_alg_falcon_1024, oqs_name))
-       return i2d_ASN1_OBJECT(OBJ_txt2obj("1.3.9999.3.4", 1), &oidbuf);
+       return "1.3.9999.3.4";
    else
    if (!strcmp(OQS_SIG_alg_picnic_L1_full, oqs_name))
-       return i2d_ASN1_OBJECT(OBJ_txt2obj("1.3.6.1.4.1.311.89.2.1.7", 1), &oidbuf);
+       return "1.3.6.1.4.1.311.89.2.1.7";
    else
    if (!strcmp(OQS_SIG_alg_picnic3_L1, oqs_name))
-       return i2d_ASN1_OBJECT(OBJ_txt2obj("1.3.6.1.4.1.311.89.2.1.21", 1), &oidbuf);
+       return "1.3.6.1.4.1.311.89.2.1.21";
    else
    if (!strcmp(OQS_SIG_alg_rainbow_I_classic, oqs_name))
-       return i2d_ASN1_OBJECT(OBJ_txt2obj("1.3.9999.5.1.1.1", 1), &oidbuf);
+       return "1.3.9999.5.1.1.1";
    else
    if (!strcmp(OQS_SIG_alg_rainbow_V_classic, oqs_name))
-       return i2d_ASN1_OBJECT(OBJ_txt2obj("1.3.9999.5.3.1.1", 1), &oidbuf);
+       return "1.3.9999.5.3.1.1";
    else
    if (!strcmp(OQS_SIG_alg_sphincs_haraka_128f_robust, oqs_name))
-       return i2d_ASN1_OBJECT(OBJ_txt2obj("1.3.9999.6.1.1", 1), &oidbuf);
+       return "1.3.9999.6.1.1";
    else
    if (!strcmp(OQS_SIG_alg_sphincs_sha256_128f_robust, oqs_name))
-       return i2d_ASN1_OBJECT(OBJ_txt2obj("1.3.9999.6.4.1", 1), &oidbuf);
+       return "1.3.9999.6.4.1";
    else
    if (!strcmp(OQS_SIG_alg_sphincs_shake256_128f_robust, oqs_name))
-       return i2d_ASN1_OBJECT(OBJ_txt2obj("1.3.9999.6.7.1", 1), &oidbuf);
+       return "1.3.9999.6.7.1";
    else
 ///// OQS_TEMPLATE_FRAGMENT_SIG_OIDS_END
-   return(0);
+   return NULL;
 }
 
 /*
@@ -131,6 +153,7 @@ static int get_oqs_oid(unsigned char* oidbuf, const char *oqs_name) {
 
 typedef struct {
     OSSL_LIB_CTX *libctx;
+    PROV_OQS_CTX *provctx;
     char *propq;
     OQSX_KEY *sig;
 
@@ -145,7 +168,7 @@ typedef struct {
     char mdname[OSSL_MAX_NAME_SIZE];
 
     /* The Algorithm Identifier of the combined signature algorithm */
-    unsigned char *aid;
+    const unsigned char *aid;
     size_t  aid_len;
 
     /* main digest */
@@ -153,6 +176,7 @@ typedef struct {
     EVP_MD_CTX *mdctx;
     size_t mdsize;
     int operation;
+    uint64_t deadline;
 } PROV_OQSSIG_CTX;
 
 
@@ -175,6 +199,7 @@ static void *oqs_sig_newctx(void *provctx, const char *propq)
         return NULL;
 
     poqs_sigctx->libctx = ((PROV_OQS_CTX*)provctx)->libctx;
+    poqs_sigctx->provctx = (PROV_OQS_CTX*)provctx;
     poqs_sigctx->flag_allow_md = 0; // TBC
     if (propq != NULL && (poqs_sigctx->propq = OPENSSL_strdup(propq)) == NULL) {
         OPENSSL_free(poqs_sigctx);
@@ -191,8 +216,25 @@ static int oqs_sig_setup_md(PROV_OQSSIG_CTX *ctx,
     if (mdprops == NULL)
         mdprops = ctx->propq;
 
+    /*
+     * The context may have been re-initialised with a key of another
+     * algorithm, so the AlgorithmIdentifier is refreshed in any case;
+     * encoded once per process, shared by all contexts.
+     */
+    if (mdname != NULL
+            && !oqsx_shared_sig_aid(ctx->sig->oqsx_provider_ctx.oqsx_qs_ctx.sig->method_name,
+                                    &ctx->aid, &ctx->aid_len)) {
+        ctx->aid = NULL;
+        ctx->aid_len = 0;
+    }
+
+    /* Same digest as before: keep method and digest context for reuse */
+    if (mdname != NULL && ctx->md != NULL && EVP_MD_is_a(ctx->md, mdname)
+            && mdprops == ctx->propq)
+        return 1;
+
     if (mdname != NULL) {
-        EVP_MD *md = EVP_MD_fetch(ctx->libctx, mdname, mdprops);
+        EVP_MD *md = oqsx_fetch_md(ctx->provctx, mdname, mdprops);
 
         if (md == NULL) {
             if (md == NULL)
@@ -205,10 +247,6 @@ static int oqs_sig_setup_md(PROV_OQSSIG_CTX *ctx,
         EVP_MD_CTX_free(ctx->mdctx);
         EVP_MD_free(ctx->md);
 
-        OPENSSL_free(ctx->aid);
-        ctx->aid = NULL; // ensure next function allocates memory
-        ctx->aid_len = get_oqs_oid(ctx->aid, ctx->sig->oqsx_provider_ctx.oqsx_qs_ctx.sig->method_name);
-
         ctx->mdctx = NULL;
         ctx->md = md;
         OPENSSL_strlcpy(ctx->mdname, mdname, sizeof(ctx->mdname));
@@ -219,6 +257,8 @@ static int oqs_sig_setup_md(PROV_OQSSIG_CTX *ctx,
 static int oqs_sig_signverify_init(void *vpoqs_sigctx, void *voqssig, int operation)
 {
     PROV_OQSSIG_CTX *poqs_sigctx = (PROV_OQSSIG_CTX *)vpoqs_sigctx;
+    OQSX_KEY_PIN pin;
+    int ok;
 
     OQS_SIG_PRINTF("OQS SIG provider: signverify_init called\n");
     if ( poqs_sigctx == NULL
@@ -228,8 +268,11 @@ static int oqs_sig_signverify_init(void *vpoqs_sigctx, void *voqssig, int operat
     oqsx_key_free(poqs_sigctx->sig);
     poqs_sigctx->sig = voqssig;
     poqs_sigctx->operation = operation;
-    if ( (operation==EVP_PKEY_OP_SIGN && !poqs_sigctx->sig->privkey) ||
-         (operation==EVP_PKEY_OP_SIGN && !poqs_sigctx->sig->pubkey)) {
+    oqsx_key_pin(poqs_sigctx->sig, &pin);
+    ok = !( (operation==EVP_PKEY_OP_SIGN && !pin.privkey) ||
+            (operation==EVP_PKEY_OP_SIGN && !pin.pubkey));
+    oqsx_key_unpin(poqs_sigctx->sig, &pin);
+    if (!ok) {
         ERR_raise(ERR_LIB_USER, OQSPROV_R_INVALID_KEY);
         return 0;
     }
@@ -239,19 +282,23 @@ static int oqs_sig_signverify_init(void *vpoqs_sigctx, void *voqssig, int operat
 static int oqs_sig_sign_init(void *vpoqs_sigctx, void *voqssig, const OSSL_PARAM params[])
 {
     OQS_SIG_PRINTF("OQS SIG provider: sign_init called\n");
-    return oqs_sig_signverify_init(vpoqs_sigctx, voqssig, EVP_PKEY_OP_SIGN);
+    return oqs_sig_signverify_init(vpoqs_sigctx, voqssig, EVP_PKEY_OP_SIGN)
+           && (params == NULL || oqs_sig_set_ctx_params(vpoqs_sigctx, params));
 }
 
 static int oqs_sig_verify_init(void *vpoqs_sigctx, void *voqssig, const OSSL_PARAM params[])
 {
     OQS_SIG_PRINTF("OQS SIG provider: verify_init called\n");
-    return oqs_sig_signverify_init(vpoqs_sigctx, voqssig, EVP_PKEY_OP_VERIFY);
+    return oqs_sig_signverify_init(vpoqs_sigctx, voqssig, EVP_PKEY_OP_VERIFY)
+           && (params == NULL || oqs_sig_set_ctx_params(vpoqs_sigctx, params));
 }
 
 static int oqs_sig_sign(void *vpoqs_sigctx, unsigned char *sig, size_t *siglen,
                     size_t sigsize, const unsigned char *tbs, size_t tbslen)
 {
     PROV_OQSSIG_CTX *poqs_sigctx = (PROV_OQSSIG_CTX *)vpoqs_sigctx;
+    OQSX_KEY_PIN pin;
+    uint64_t trace = oqsx_trace_begin();
     int ret = 0;
     size_t oqs_sigsize = poqs_sigctx->sig->oqsx_provider_ctx.oqsx_qs_ctx.sig->length_signature;
     size_t mdsize = oqs_sig_get_md_size(poqs_sigctx);
@@ -273,7 +320,14 @@ static int oqs_sig_sign(void *vpoqs_sigctx, unsigned char *sig, size_t *siglen,
         return 0;
     }
 
-    ret = OQS_SIG_sign(poqs_sigctx->sig->oqsx_provider_ctx.oqsx_qs_ctx.sig, sig, siglen, tbs, tbslen, poqs_sigctx->sig->privkey);
+    if (oqsx_deadline_passed(poqs_sigctx->deadline))
+        return 0;
+
+    oqsx_key_pin(poqs_sigctx->sig, &pin);
+    ret = poqs_sigctx->sig->backend->sig_sign(poqs_sigctx->sig->oqsx_provider_ctx.oqsx_qs_ctx.sig, sig, siglen, tbs, tbslen, pin.privkey);
+    oqsx_key_unpin(poqs_sigctx->sig, &pin);
+    oqsx_trace_end(trace, poqs_sigctx->sig, OQSX_TRACE_OP_SIGN, tbslen,
+                   ret == OQS_SUCCESS ? *siglen : 0, ret == OQS_SUCCESS);
     if (ret != OQS_SUCCESS) {
         printf("OQS sign error\n");
         return 0;
@@ -287,13 +341,20 @@ static int oqs_sig_verify(void *vpoqs_sigctx, const unsigned char *sig, size_t s
 {
     PROV_OQSSIG_CTX *poqs_sigctx = (PROV_OQSSIG_CTX *)vpoqs_sigctx;
     size_t mdsize = oqs_sig_get_md_size(poqs_sigctx);
+    OQSX_KEY_PIN pin;
+    uint64_t trace = oqsx_trace_begin();
     int ret = 0;
 
     OQS_SIG_PRINTF("OQS SIG provider: verify called\n");
     if (mdsize != 0 && tbslen != mdsize)
         return 0;
+    if (oqsx_deadline_passed(poqs_sigctx->deadline))
+        return 0;
 
-    ret = OQS_SIG_verify(poqs_sigctx->sig->oqsx_provider_ctx.oqsx_qs_ctx.sig, tbs, tbslen, sig, siglen, poqs_sigctx->sig->pubkey);
+    oqsx_key_pin(poqs_sigctx->sig, &pin);
+    ret = poqs_sigctx->sig->backend->sig_verify(poqs_sigctx->sig->oqsx_provider_ctx.oqsx_qs_ctx.sig, tbs, tbslen, sig, siglen, pin.pubkey);
+    oqsx_key_unpin(poqs_sigctx->sig, &pin);
+    oqsx_trace_end(trace, poqs_sigctx->sig, OQSX_TRACE_OP_VERIFY, tbslen, siglen, ret == OQS_SUCCESS);
     if (ret != OQS_SUCCESS) {
         printf("OQS sign error\n");
         return 0;
@@ -316,9 +377,11 @@ static int oqs_sig_digest_signverify_init(void *vpoqs_sigctx, const char *mdname
     if (!oqs_sig_setup_md(poqs_sigctx, mdname, NULL))
         return 0;
 
-    poqs_sigctx->mdctx = EVP_MD_CTX_new();
-    if (poqs_sigctx->mdctx == NULL)
-        goto error;
+    if (poqs_sigctx->mdctx == NULL) {
+        poqs_sigctx->mdctx = EVP_MD_CTX_new();
+        if (poqs_sigctx->mdctx == NULL)
+            goto error;
+    }
 
     if (!EVP_DigestInit_ex(poqs_sigctx->mdctx, poqs_sigctx->md, NULL))
         goto error;
@@ -337,13 +400,15 @@ static int oqs_sig_digest_sign_init(void *vpoqs_sigctx, const char *mdname,
                                       void *voqssig, const OSSL_PARAM params[])
 {
     OQS_SIG_PRINTF("OQS SIG provider: digest_sign_init called\n");
-    return oqs_sig_digest_signverify_init(vpoqs_sigctx, mdname, voqssig, EVP_PKEY_OP_SIGN);
+    return oqs_sig_digest_signverify_init(vpoqs_sigctx, mdname, voqssig, EVP_PKEY_OP_SIGN)
+           && (params == NULL || oqs_sig_set_ctx_params(vpoqs_sigctx, params));
 }
 
 static int oqs_sig_digest_verify_init(void *vpoqs_sigctx, const char *mdname, void *voqssig, const OSSL_PARAM params[])
 {
     OQS_SIG_PRINTF("OQS SIG provider: sig_digest_verify called\n");
-    return oqs_sig_digest_signverify_init(vpoqs_sigctx, mdname, voqssig, EVP_PKEY_OP_VERIFY);
+    return oqs_sig_digest_signverify_init(vpoqs_sigctx, mdname, voqssig, EVP_PKEY_OP_VERIFY)
+           && (params == NULL || oqs_sig_set_ctx_params(vpoqs_sigctx, params));
 }
 
 int oqs_sig_digest_signverify_update(void *vpoqs_sigctx, const unsigned char *data,
@@ -527,12 +592,17 @@ static int oqs_sig_set_ctx_params(void *vpoqs_sigctx, const OSSL_PARAM params[])
             return 0;
     }
 
+    p = OSSL_PARAM_locate_const(params, OQS_PARAM_DEADLINE);
+    if (p != NULL && !OSSL_PARAM_get_uint64(p, &poqs_sigctx->deadline))
+        return 0;
+
     return 1;
 }
 
 static const OSSL_PARAM known_settable_ctx_params[] = {
     OSSL_PARAM_utf8_string(OSSL_SIGNATURE_PARAM_DIGEST, NULL, 0),
     OSSL_PARAM_utf8_string(OSSL_SIGNATURE_PARAM_PROPERTIES, NULL, 0),
+    OSSL_PARAM_uint64(OQS_PARAM_DEADLINE, NULL),
     OSSL_PARAM_END
 };
 
@@ -10,6 +10,8 @@
 
 #include <string.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <openssl/core.h>
 #include <openssl/core_dispatch.h>
 #include <openssl/core_names.h>
@@ -45,6 +47,11 @@ static const OSSL_PARAM oqsprovider_param_types[] = {
     OSSL_PARAM_DEFN(OSSL_PROV_PARAM_VERSION, OSSL_PARAM_UTF8_PTR, NULL, 0),
     OSSL_PARAM_DEFN(OSSL_PROV_PARAM_BUILDINFO, OSSL_PARAM_UTF8_PTR, NULL, 0),
     OSSL_PARAM_DEFN(OSSL_PROV_PARAM_STATUS, OSSL_PARAM_INTEGER, NULL, 0),
+    OSSL_PARAM_DEFN(OQS_PROV_PARAM_LIVE_KEYS, OSSL_PARAM_UNSIGNED_INTEGER, NULL, 0),
+    OSSL_PARAM_DEFN(OQS_PROV_PARAM_KEM_KEYGENS, OSSL_PARAM_UNSIGNED_INTEGER, NULL, 0),
+    OSSL_PARAM_DEFN(OQS_PROV_PARAM_KEM_REUSES, OSSL_PARAM_UNSIGNED_INTEGER, NULL, 0),
+    OSSL_PARAM_DEFN(OQS_PROV_PARAM_ARENA_SIZE, OSSL_PARAM_UNSIGNED_INTEGER, NULL, 0),
+    OSSL_PARAM_DEFN(OQS_PROV_PARAM_ARENA_USED, OSSL_PARAM_UNSIGNED_INTEGER, NULL, 0),
     OSSL_PARAM_END
 };
 
@@ -326,6 +333,15 @@ static const OSSL_ALGORITHM oqsprovider_keymgmt[] = {
     { NULL, NULL, NULL }
 };
 
+/*
+ * Each key manager serves one liboqs algorithm (hybrids share theirs), so
+ * this bounds the entries of the shared algorithm store.
+ */
+size_t oqsx_keymgmt_count(void)
+{
+    return sizeof(oqsprovider_keymgmt) / sizeof(oqsprovider_keymgmt[0]) - 1;
+}
+
 static const OSSL_PARAM *oqsprovider_gettable_params(void *provctx)
 {
     return oqsprovider_param_types;
@@ -333,7 +349,9 @@ static const OSSL_PARAM *oqsprovider_gettable_params(void *provctx)
 
 static int oqsprovider_get_params(void *provctx, OSSL_PARAM params[])
 {
+    PROV_OQS_CTX *ctx = provctx;
     OSSL_PARAM *p;
+    size_t arena_size, arena_used;
 
     p = OSSL_PARAM_locate(params, OSSL_PROV_PARAM_NAME);
     if (p != NULL && !OSSL_PARAM_set_utf8_ptr(p, "OpenSSL OQS Provider"))
@@ -347,6 +365,22 @@ static int oqsprovider_get_params(void *provctx, OSSL_PARAM params[])
     p = OSSL_PARAM_locate(params, OSSL_PROV_PARAM_STATUS);
     if (p != NULL && !OSSL_PARAM_set_int(p, 1)) // provider is always running
         return 0;
+    p = OSSL_PARAM_locate(params, OQS_PROV_PARAM_LIVE_KEYS);
+    if (p != NULL && !OSSL_PARAM_set_size_t(p, oqsx_key_live_count()))
+        return 0;
+    p = OSSL_PARAM_locate(params, OQS_PROV_PARAM_KEM_KEYGENS);
+    if (p != NULL && !OSSL_PARAM_set_uint64(p, oqsx_counter_read(&ctx->kem_keygens)))
+        return 0;
+    p = OSSL_PARAM_locate(params, OQS_PROV_PARAM_KEM_REUSES);
+    if (p != NULL && !OSSL_PARAM_set_uint64(p, oqsx_counter_read(&ctx->kem_reuses)))
+        return 0;
+    oqsx_arena_stats(&arena_size, &arena_used);
+    p = OSSL_PARAM_locate(params, OQS_PROV_PARAM_ARENA_SIZE);
+    if (p != NULL && !OSSL_PARAM_set_size_t(p, arena_size))
+        return 0;
+    p = OSSL_PARAM_locate(params, OQS_PROV_PARAM_ARENA_USED);
+    if (p != NULL && !OSSL_PARAM_set_size_t(p, arena_used))
+        return 0;
     return 1;
 }
 
@@ -367,6 +401,63 @@ static const OSSL_ALGORITHM *oqsprovider_query(void *provctx, int operation_id,
     return NULL;
 }
 
+/* Ephemeral key reuse settings from the provider's configuration section */
+static int oqsprovider_configure_reuse(const OSSL_CORE_HANDLE *handle, PROV_OQS_CTX *ctx)
+{
+    char *uses = NULL, *ms = NULL, *end;
+    unsigned long max_uses;
+    unsigned long long max_ms;
+    OSSL_PARAM conf[] = {
+        OSSL_PARAM_utf8_ptr(OQS_PROV_CONF_REUSE_USES, &uses, 0),
+        OSSL_PARAM_utf8_ptr(OQS_PROV_CONF_REUSE_MS, &ms, 0),
+        OSSL_PARAM_END
+    };
+
+    if (c_get_params == NULL || !c_get_params(handle, conf) || uses == NULL || ms == NULL)
+        return 1;
+    max_uses = strtoul(uses, &end, 10);
+    if (*uses == '\0' || *end != '\0')
+        return 0;
+    max_ms = strtoull(ms, &end, 10);
+    if (*ms == '\0' || *end != '\0')
+        return 0;
+    return oqsx_reuse_configure(ctx, max_uses, max_ms);
+}
+
+/* Backend selection from the provider's configuration section */
+static int oqsprovider_configure_backends(const OSSL_CORE_HANDLE *handle)
+{
+    char *backend = NULL, *backends = NULL;
+    OSSL_PARAM conf[] = {
+        OSSL_PARAM_utf8_ptr(OQS_PROV_CONF_BACKEND, &backend, 0),
+        OSSL_PARAM_utf8_ptr(OQS_PROV_CONF_BACKENDS, &backends, 0),
+        OSSL_PARAM_END
+    };
+
+    if (c_get_params == NULL || !c_get_params(handle, conf)
+            || (backend == NULL && backends == NULL))
+        return 1;
+    return oqsx_backend_configure(backend, backends);
+}
+
+/* Private key arena from the provider's configuration section */
+static int oqsprovider_configure_arena(const OSSL_CORE_HANDLE *handle)
+{
+    char *size = NULL, *end;
+    unsigned long long n;
+    OSSL_PARAM conf[] = {
+        OSSL_PARAM_utf8_ptr(OQS_PROV_CONF_ARENA_SIZE, &size, 0),
+        OSSL_PARAM_END
+    };
+
+    if (c_get_params == NULL || !c_get_params(handle, conf) || size == NULL)
+        return 1;
+    n = strtoull(size, &end, 10);
+    if (*size == '\0' || *end != '\0' || n > SIZE_MAX)
+        return 0;
+    return oqsx_arena_configure((size_t)n);
+}
+
 static void oqsprovider_teardown(void *provctx)
 {
    oqsx_freeprovctx((PROV_OQS_CTX*)provctx);
@@ -411,9 +502,13 @@ int OSSL_provider_init(const OSSL_CORE_HANDLE *handle,
         return 0;
 
     if ( ((libctx = OSSL_LIB_CTX_new()) == NULL) ||
-         (*provctx = oqsx_newprovctx(libctx, handle)) == NULL ) {
-        OSSL_LIB_CTX_free(libctx);
+         (*provctx = oqsx_newprovctx(libctx, handle)) == NULL ||
+         !oqsprovider_configure_reuse(handle, *provctx) ||
+         !oqsprovider_configure_backends(handle) ||
+         !oqsprovider_configure_arena(handle) ) {
+        // the provider context holds digests fetched from libctx
         oqsprovider_teardown(*provctx);
+        OSSL_LIB_CTX_free(libctx);
         *provctx = NULL;
         return 0;
     }
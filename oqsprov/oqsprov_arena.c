@@ -0,0 +1,313 @@
+// SPDX-License-Identifier: Apache-2.0 AND MIT
+
+/*
+ * OQS OpenSSL 3 provider
+ *
+ * Optional arena for private key material, reserved once when the provider
+ * is loaded (see OQS_PROV_CONF_ARENA_SIZE). The memory is mapped with huge
+ * pages if available, prefaulted and locked, so that key generation under
+ * load does not take page faults. It is cut into slabs, each serving blocks
+ * of a single size class; classes are created for the exact (aligned) sizes
+ * requested, i.e. the private key sizes of the algorithms in use. Requests
+ * the arena cannot serve fall back to the OpenSSL secure heap.
+ *
+ * The arena is process-wide and stays mapped until the process exits, as
+ * keys may be released after the provider instance that configured it.
+ * If it cannot be set up, the provider still loads and uses the secure heap.
+ *
+ * Free lists are kept per CPU shard (see oqsprov_shard.c), each under its
+ * own lock: blocks are freed to the shard of the releasing CPU and taken
+ * from the caller's shard first, then from a fresh slab, and only once all
+ * slabs are handed out from other shards. The global lock is taken just to
+ * register a size class or carve a slab.
+ *
+ * base is published last (release) once everything else is set up, so a
+ * non-NULL base read with acquire semantics implies the locks, size and
+ * slab table are valid; they never change afterwards. Likewise, a class
+ * size is written before nclasses is raised to include it.
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE /* MAP_ANONYMOUS, MAP_HUGETLB, MADV_* */
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <openssl/crypto.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "oqsx.h"
+
+#ifdef NDEBUG
+#define OQS_ARENA_PRINTF(a)
+#define OQS_ARENA_PRINTF2(a, b)
+#define OQS_ARENA_PRINTF3(a, b, c)
+#else
+#define OQS_ARENA_PRINTF(a) if (getenv("OQSARENA")) printf(a)
+#define OQS_ARENA_PRINTF2(a, b) if (getenv("OQSARENA")) printf(a, b)
+#define OQS_ARENA_PRINTF3(a, b, c) if (getenv("OQSARENA")) printf(a, b, c)
+#endif // NDEBUG
+
+#define OQSX_ARENA_SLAB (64 * 1024)
+#define OQSX_ARENA_ALIGN 64
+#define OQSX_ARENA_MAX_CLASSES 32
+#define OQSX_ARENA_HUGE_PAGE (2 * 1024 * 1024)
+
+static struct {
+    _Atomic(unsigned char *) base;
+    size_t size;
+    size_t nslabs;
+    size_t next_slab;
+    unsigned char *slab_class; /* class index of each slab handed out */
+    size_t class_size[OQSX_ARENA_MAX_CLASSES];
+    _Atomic size_t nclasses;
+} oqsx_arena;
+
+/* Freed blocks of each class, linked through their first word */
+struct oqsx_arena_shard_st {
+    _Alignas(OQSX_CACHE_LINE) CRYPTO_RWLOCK *lock;
+    void *free[OQSX_ARENA_MAX_CLASSES];
+};
+
+static struct oqsx_arena_shard_st oqsx_arena_shards[OQSX_NUM_SHARDS];
+static OQSX_COUNTER oqsx_arena_used;
+
+static CRYPTO_RWLOCK *oqsx_arena_lock = NULL;
+static CRYPTO_ONCE oqsx_arena_once = CRYPTO_ONCE_STATIC_INIT;
+
+/* Leaves oqsx_arena_lock NULL, disabling the arena, unless all locks exist */
+static void oqsx_arena_init(void)
+{
+    int i;
+
+    for (i = 0; i < OQSX_NUM_SHARDS; i++) {
+        if ((oqsx_arena_shards[i].lock = CRYPTO_THREAD_lock_new()) == NULL) {
+            while (i-- > 0)
+                CRYPTO_THREAD_lock_free(oqsx_arena_shards[i].lock);
+            return;
+        }
+    }
+    oqsx_arena_lock = CRYPTO_THREAD_lock_new();
+}
+
+#if defined(__linux__)
+/* Maps, prefaults and locks size bytes; returns NULL on errors */
+static unsigned char *oqsx_arena_map(size_t *size)
+{
+    size_t hugesize = (*size + OQSX_ARENA_HUGE_PAGE - 1) & ~(size_t)(OQSX_ARENA_HUGE_PAGE - 1);
+    long pagesize = sysconf(_SC_PAGESIZE);
+    unsigned char *base;
+    size_t i;
+
+    base = mmap(NULL, hugesize, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+    if (base != MAP_FAILED) {
+        *size = hugesize;
+    } else {
+        // no preallocated huge pages: ask for transparent ones instead
+        base = mmap(NULL, *size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED)
+            return NULL;
+        madvise(base, *size, MADV_HUGEPAGE);
+    }
+    madvise(base, *size, MADV_DONTDUMP);
+    if (mlock(base, *size) != 0) {
+        OQS_ARENA_PRINTF2("OQS ARENA: mlock of %zu bytes failed, arena not locked\n", *size);
+        for (i = 0; i < *size; i += pagesize > 0 ? (size_t)pagesize : 4096)
+            base[i] = 0;
+    }
+    return base;
+}
+#endif
+
+/*
+ * Sets up the arena; failures only leave allocations on the secure heap.
+ * Returns 1 in any case, keeping the int result for callers' error paths.
+ */
+int oqsx_arena_configure(size_t size)
+{
+    unsigned char *base, *slab_class;
+
+    if (size == 0)
+        return 1;
+    if (size < OQSX_ARENA_SLAB) {
+        OQS_ARENA_PRINTF3("OQS ARENA: %zu bytes below minimum of %d, not used\n",
+                          size, OQSX_ARENA_SLAB);
+        return 1;
+    }
+    size -= size % OQSX_ARENA_SLAB;
+    if (!CRYPTO_THREAD_run_once(&oqsx_arena_once, oqsx_arena_init)
+            || oqsx_arena_lock == NULL
+            || !CRYPTO_THREAD_write_lock(oqsx_arena_lock)) {
+        OQS_ARENA_PRINTF("OQS ARENA: no lock, not used\n");
+        return 1;
+    }
+    // the first provider instance configuring an arena sets it up for all
+    if (atomic_load(&oqsx_arena.base) != NULL)
+        goto end;
+#if defined(__linux__)
+    if ((base = oqsx_arena_map(&size)) == NULL) {
+        OQS_ARENA_PRINTF2("OQS ARENA: mapping %zu bytes failed, not used\n", size);
+        goto end;
+    }
+    if ((slab_class = OPENSSL_zalloc(size / OQSX_ARENA_SLAB)) == NULL) {
+        OQS_ARENA_PRINTF2("OQS ARENA: no slab table for %zu bytes, not used\n", size);
+        munmap(base, size);
+        goto end;
+    }
+    oqsx_arena.size = size;
+    oqsx_arena.nslabs = size / OQSX_ARENA_SLAB;
+    oqsx_arena.slab_class = slab_class;
+    atomic_store(&oqsx_arena.base, base);
+    OQS_ARENA_PRINTF3("OQS ARENA: %zu bytes at %p\n", size, (void *)base);
+#else
+    (void)base;
+    (void)slab_class;
+    OQS_ARENA_PRINTF2("OQS ARENA: not supported on this platform (%zu bytes), not used\n", size);
+#endif
+
+    end:
+    CRYPTO_THREAD_unlock(oqsx_arena_lock);
+    return 1;
+}
+
+/* Returns the index of the size class bsize, registering it if new */
+static int oqsx_arena_class(size_t bsize)
+{
+    size_t i, n = atomic_load(&oqsx_arena.nclasses);
+    int c = -1;
+
+    for (i = 0; i < n; i++)
+        if (oqsx_arena.class_size[i] == bsize)
+            return (int)i;
+    if (!CRYPTO_THREAD_write_lock(oqsx_arena_lock))
+        return -1;
+    // another thread may have registered it meanwhile
+    n = atomic_load(&oqsx_arena.nclasses);
+    for (i = 0; i < n && c < 0; i++)
+        if (oqsx_arena.class_size[i] == bsize)
+            c = (int)i;
+    if (c < 0 && n < OQSX_ARENA_MAX_CLASSES) {
+        oqsx_arena.class_size[n] = bsize;
+        atomic_store(&oqsx_arena.nclasses, n + 1);
+        c = (int)n;
+    }
+    CRYPTO_THREAD_unlock(oqsx_arena_lock);
+    return c;
+}
+
+static void *oqsx_arena_pop(struct oqsx_arena_shard_st *sh, int c)
+{
+    void *block;
+
+    if (!CRYPTO_THREAD_write_lock(sh->lock))
+        return NULL;
+    if ((block = sh->free[c]) != NULL)
+        sh->free[c] = *(void **)block;
+    CRYPTO_THREAD_unlock(sh->lock);
+    return block;
+}
+
+/*
+ * Carves a fresh slab for class c: its first block is returned, the others
+ * go to the free list of shard sh. Returns NULL once all slabs are used.
+ */
+static void *oqsx_arena_carve(unsigned char *base, struct oqsx_arena_shard_st *sh,
+                              int c, size_t bsize)
+{
+    unsigned char *slab, *tail;
+    void *chain = NULL;
+    size_t off;
+
+    if (!CRYPTO_THREAD_write_lock(oqsx_arena_lock))
+        return NULL;
+    if (oqsx_arena.next_slab == oqsx_arena.nslabs) {
+        CRYPTO_THREAD_unlock(oqsx_arena_lock);
+        return NULL;
+    }
+    oqsx_arena.slab_class[oqsx_arena.next_slab] = (unsigned char)c;
+    slab = base + oqsx_arena.next_slab++ * OQSX_ARENA_SLAB;
+    CRYPTO_THREAD_unlock(oqsx_arena_lock);
+
+    // the slab is ours alone until its blocks are linked into the shard
+    tail = slab + (OQSX_ARENA_SLAB / bsize - 1) * bsize;
+    for (off = tail - slab; off > 0; off -= bsize) {
+        *(void **)(slab + off) = chain;
+        chain = slab + off;
+    }
+    if (chain != NULL && CRYPTO_THREAD_write_lock(sh->lock)) {
+        *(void **)tail = sh->free[c];
+        sh->free[c] = chain;
+        CRYPTO_THREAD_unlock(sh->lock);
+    }
+    return slab;
+}
+
+/* Takes a block of class c: own shard, fresh slab, then the other shards */
+static void *oqsx_arena_take(unsigned char *base, int c, size_t bsize)
+{
+    int home = oqsx_shard_index(), i;
+    void *block;
+
+    if ((block = oqsx_arena_pop(&oqsx_arena_shards[home], c)) != NULL
+            || (block = oqsx_arena_carve(base, &oqsx_arena_shards[home], c, bsize)) != NULL)
+        return block;
+    for (i = 1; i < OQSX_NUM_SHARDS && block == NULL; i++)
+        block = oqsx_arena_pop(&oqsx_arena_shards[(home + i) % OQSX_NUM_SHARDS], c);
+    return block;
+}
+
+void *oqsx_arena_zalloc(size_t len)
+{
+    size_t bsize = (len + OQSX_ARENA_ALIGN - 1) & ~(size_t)(OQSX_ARENA_ALIGN - 1);
+    unsigned char *base = atomic_load(&oqsx_arena.base);
+    void *block = NULL;
+    int c;
+
+    if (base != NULL && len > 0 && bsize <= OQSX_ARENA_SLAB
+            && (c = oqsx_arena_class(bsize)) >= 0)
+        block = oqsx_arena_take(base, c, bsize);
+    if (block == NULL)
+        return OPENSSL_secure_zalloc(len);
+    memset(block, 0, bsize);
+    oqsx_counter_add(&oqsx_arena_used, (int64_t)bsize);
+    return block;
+}
+
+void oqsx_arena_clear_free(void *ptr, size_t len)
+{
+    unsigned char *p = ptr;
+    unsigned char *base = atomic_load(&oqsx_arena.base);
+    struct oqsx_arena_shard_st *sh;
+    size_t bsize;
+    int c;
+
+    if (p == NULL)
+        return;
+    if (base == NULL || p < base || p >= base + oqsx_arena.size) {
+        OPENSSL_secure_clear_free(ptr, len);
+        return;
+    }
+    // the slab's class was set when it was carved, before p was handed out
+    c = oqsx_arena.slab_class[(p - base) / OQSX_ARENA_SLAB];
+    bsize = oqsx_arena.class_size[c];
+    OPENSSL_cleanse(p, bsize);
+    sh = &oqsx_arena_shards[oqsx_shard_index()];
+    if (!CRYPTO_THREAD_write_lock(sh->lock))
+        return;
+    *(void **)p = sh->free[c];
+    sh->free[c] = p;
+    CRYPTO_THREAD_unlock(sh->lock);
+    oqsx_counter_add(&oqsx_arena_used, -(int64_t)bsize);
+}
+
+void oqsx_arena_stats(size_t *size, size_t *used)
+{
+    *size = *used = 0;
+    if (atomic_load(&oqsx_arena.base) == NULL)
+        return;
+    *size = oqsx_arena.size;
+    *used = (size_t)oqsx_counter_read(&oqsx_arena_used);
+}
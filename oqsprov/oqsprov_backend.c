@@ -0,0 +1,184 @@
+// SPDX-License-Identifier: Apache-2.0 AND MIT
+
+/*
+ * OQS OpenSSL 3 provider
+ *
+ * Backends implementing the PQ primitives (see OQSX_BACKEND). liboqs is
+ * the default; further implementations are added to oqsx_backends and
+ * selected per algorithm via the provider configuration.
+ */
+
+#include <openssl/crypto.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "oqsx.h"
+
+#ifdef NDEBUG
+#define OQS_BE_PRINTF2(a, b)
+#define OQS_BE_PRINTF3(a, b, c)
+#else
+#define OQS_BE_PRINTF2(a, b) if (getenv("OQSBE")) printf(a, b)
+#define OQS_BE_PRINTF3(a, b, c) if (getenv("OQSBE")) printf(a, b, c)
+#endif // NDEBUG
+
+/* liboqs has no batch API: one call per recipient, stopping at errors */
+static OQS_STATUS oqsx_liboqs_kem_encaps_batch(const OQS_KEM *kem, size_t n, uint8_t *ct,
+                                               uint8_t *ss, const uint8_t *pk)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        if (OQS_KEM_encaps(kem, ct + i * kem->length_ciphertext,
+                           ss + i * kem->length_shared_secret,
+                           pk + i * kem->length_public_key) != OQS_SUCCESS)
+            return OQS_ERROR;
+    }
+    return OQS_SUCCESS;
+}
+
+static const OQSX_BACKEND oqsx_backend_liboqs = {
+    "liboqs",
+    OQSX_BACKEND_KEM | OQSX_BACKEND_SIG,
+    NULL,
+    OQS_KEM_keypair,
+    OQS_KEM_encaps,
+    OQS_KEM_decaps,
+    oqsx_liboqs_kem_encaps_batch,
+    OQS_SIG_keypair,
+    OQS_SIG_sign,
+    OQS_SIG_verify
+};
+
+static const OQSX_BACKEND *oqsx_backends[] = {
+    &oqsx_backend_liboqs,
+};
+
+#define OQSX_NUM_BACKENDS (sizeof(oqsx_backends) / sizeof(oqsx_backends[0]))
+#define OQSX_MAX_BACKEND_OVERRIDES 32
+#define OQSX_MAX_ALG_NAME 64
+
+struct oqsx_backend_override_st {
+    char oqs_name[OQSX_MAX_ALG_NAME];
+    const OQSX_BACKEND *backend;
+};
+
+static const OQSX_BACKEND *oqsx_backend_default = &oqsx_backend_liboqs;
+static struct oqsx_backend_override_st oqsx_backend_overrides[OQSX_MAX_BACKEND_OVERRIDES];
+static size_t oqsx_backend_num_overrides = 0;
+static CRYPTO_RWLOCK *oqsx_backend_lock = NULL;
+static CRYPTO_ONCE oqsx_backend_once = CRYPTO_ONCE_STATIC_INIT;
+
+static void oqsx_backend_init(void)
+{
+    oqsx_backend_lock = CRYPTO_THREAD_lock_new();
+}
+
+static const OQSX_BACKEND *oqsx_backend_find(const char *name, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < OQSX_NUM_BACKENDS; i++) {
+        if (strlen(oqsx_backends[i]->name) == len
+                && !strncmp(oqsx_backends[i]->name, name, len))
+            return oqsx_backends[i];
+    }
+    return NULL;
+}
+
+static int oqsx_backend_implements(const OQSX_BACKEND *backend, const char *oqs_name, int is_kem)
+{
+    if ((backend->flags & (is_kem ? OQSX_BACKEND_KEM : OQSX_BACKEND_SIG)) == 0)
+        return 0;
+    return backend->supports == NULL || backend->supports(oqs_name, is_kem);
+}
+
+/*
+ * Parses "alg:backend[,alg:backend...]" (blanks around items are ignored)
+ * into overrides; returns the number parsed, -1 on errors.
+ */
+static int oqsx_backend_parse(const char *s, struct oqsx_backend_override_st *out)
+{
+    const char *item, *colon, *end;
+    size_t n = 0, len;
+
+    while (*s != '\0') {
+        while (*s == ' ' || *s == ',')
+            s++;
+        if (*s == '\0')
+            break;
+        item = s;
+        end = item + strcspn(item, ",");
+        s = end;
+        while (end > item && end[-1] == ' ')
+            end--;
+        if ((colon = memchr(item, ':', end - item)) == NULL || n == OQSX_MAX_BACKEND_OVERRIDES)
+            return -1;
+        len = colon - item;
+        while (len > 0 && item[len - 1] == ' ')
+            len--;
+        if (len == 0 || len >= OQSX_MAX_ALG_NAME)
+            return -1;
+        memcpy(out[n].oqs_name, item, len);
+        out[n].oqs_name[len] = '\0';
+        for (colon++; *colon == ' '; colon++)
+            continue;
+        if ((out[n].backend = oqsx_backend_find(colon, end - colon)) == NULL)
+            return -1;
+        n++;
+    }
+    return (int)n;
+}
+
+int oqsx_backend_configure(const char *backend, const char *overrides)
+{
+    struct oqsx_backend_override_st parsed[OQSX_MAX_BACKEND_OVERRIDES];
+    const OQSX_BACKEND *def = &oqsx_backend_liboqs;
+    int n = 0;
+
+    if (backend != NULL && (def = oqsx_backend_find(backend, strlen(backend))) == NULL) {
+        OQS_BE_PRINTF2("OQS BACKEND: unknown backend %s\n", backend);
+        return 0;
+    }
+    if (overrides != NULL && (n = oqsx_backend_parse(overrides, parsed)) < 0) {
+        OQS_BE_PRINTF2("OQS BACKEND: invalid backend list %s\n", overrides);
+        return 0;
+    }
+
+    if (!CRYPTO_THREAD_run_once(&oqsx_backend_once, oqsx_backend_init)
+            || oqsx_backend_lock == NULL
+            || !CRYPTO_THREAD_write_lock(oqsx_backend_lock))
+        return 0;
+    oqsx_backend_default = def;
+    memcpy(oqsx_backend_overrides, parsed, n * sizeof(parsed[0]));
+    oqsx_backend_num_overrides = n;
+    CRYPTO_THREAD_unlock(oqsx_backend_lock);
+    return 1;
+}
+
+/*
+ * Returns the backend configured for the algorithm, falling back to liboqs
+ * if the configured one does not implement it.
+ */
+const OQSX_BACKEND *oqsx_backend_select(const char *oqs_name, int is_kem)
+{
+    const OQSX_BACKEND *ret = &oqsx_backend_liboqs;
+    size_t i;
+
+    if (CRYPTO_THREAD_run_once(&oqsx_backend_once, oqsx_backend_init)
+            && oqsx_backend_lock != NULL
+            && CRYPTO_THREAD_read_lock(oqsx_backend_lock)) {
+        ret = oqsx_backend_default;
+        for (i = 0; i < oqsx_backend_num_overrides; i++) {
+            if (!strcmp(oqsx_backend_overrides[i].oqs_name, oqs_name)) {
+                ret = oqsx_backend_overrides[i].backend;
+                break;
+            }
+        }
+        CRYPTO_THREAD_unlock(oqsx_backend_lock);
+    }
+    if (!oqsx_backend_implements(ret, oqs_name, is_kem))
+        ret = &oqsx_backend_liboqs;
+    OQS_BE_PRINTF3("OQS BACKEND: using %s for %s\n", ret->name, oqs_name);
+    return ret;
+}
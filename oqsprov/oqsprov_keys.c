@@ -9,6 +9,9 @@
  * TBC: Use/test in more than KEM and SIG cases.
  */
 
+#define _POSIX_C_SOURCE 200809L /* clock_gettime */
+
+#include <openssl/crypto.h>
 #include <openssl/err.h>
 #include <openssl/params.h>
 #include <openssl/core_names.h>
@@ -16,80 +19,519 @@
 #include <openssl/ec.h>
 #include <string.h>
 #include <assert.h>
+#include <sched.h>
+#include <time.h>
 #include "oqsx.h"
 
 /// Provider code
 
+// digests used by the signature code, fetched once per provider instance
+static const char *oqsx_cached_mdnames[OQSX_NUM_CACHED_MDS] = {
+    "SHA2-256", "SHA2-384", "SHA2-512",
+    "SHA3-256", "SHA3-384", "SHA3-512",
+    "SHAKE-128", "SHAKE-256"
+};
+
 PROV_OQS_CTX *oqsx_newprovctx(OSSL_LIB_CTX *libctx, const OSSL_CORE_HANDLE *handle) {
     PROV_OQS_CTX * ret = OPENSSL_zalloc(sizeof(PROV_OQS_CTX));
+    int i;
+
+    if (ret && !oqsx_shared_acquire()) {
+       OPENSSL_free(ret);
+       return NULL;
+    }
     if (ret) {
        ret->libctx = libctx;
        ret->handle = handle;
+       // unavailable digests stay NULL and are fetched on use
+       for (i = 0; i < OQSX_NUM_CACHED_MDS; i++)
+           ret->mds[i] = EVP_MD_fetch(libctx, oqsx_cached_mdnames[i], NULL);
     }
     return ret;
 }
 
 void oqsx_freeprovctx(PROV_OQS_CTX *ctx) {
+    int i;
+
+    if (ctx == NULL)
+        return;
+    for (i = 0; i < OQSX_NUM_CACHED_MDS; i++)
+        EVP_MD_free(ctx->mds[i]);
+    for (i = 0; i < OQSX_MAX_REUSE_SLOTS; i++)
+        oqsx_key_free(ctx->reuse[i].key);
+    CRYPTO_THREAD_lock_free(ctx->reuse_lock);
     OPENSSL_free(ctx);
+    oqsx_shared_release();
+}
+
+/*
+ * Returns a reference to the digest, taken from the provider cache when no
+ * specific properties are requested.
+ */
+EVP_MD *oqsx_fetch_md(PROV_OQS_CTX *ctx, const char *mdname, const char *mdprops)
+{
+    int i;
+
+    if (mdprops == NULL || *mdprops == '\0') {
+        for (i = 0; i < OQSX_NUM_CACHED_MDS; i++) {
+            if (ctx->mds[i] != NULL && EVP_MD_is_a(ctx->mds[i], mdname)
+                    && EVP_MD_up_ref(ctx->mds[i]))
+                return ctx->mds[i];
+        }
+    }
+    return EVP_MD_fetch(ctx->libctx, mdname, mdprops);
+}
+
+/// Shared algorithm state
+
+/*
+ * Entries are only appended (under the write lock) and published by
+ * bumping the count, so lookups of known algorithms take no lock. The
+ * store is allocated by the first provider instance, with room for every
+ * algorithm of the key management table, and released together with its
+ * entries when the last one goes away.
+ *
+ * ToDo: A snapshot of this state across restarts would not pay off yet:
+ * entries are liboqs descriptors (static tables) and DER-encoded OIDs, all
+ * built in microseconds on first use. Should per-key precomputation (e.g.
+ * expanded public matrices) ever be cached, it would be the candidate for
+ * a versioned, checksummed snapshot keyed by public key fingerprint.
+ */
+static OQSX_SHARED_ALG *oqsx_shared_algs = NULL;
+static size_t oqsx_shared_max = 0;
+static _Atomic size_t oqsx_shared_count = 0;
+static int oqsx_shared_refs = 0;
+static CRYPTO_RWLOCK *oqsx_shared_lock = NULL;
+static CRYPTO_ONCE oqsx_shared_once = CRYPTO_ONCE_STATIC_INIT;
+
+static void oqsx_shared_init(void)
+{
+    oqsx_shared_lock = CRYPTO_THREAD_lock_new();
+}
+
+int oqsx_shared_acquire(void)
+{
+    int ret = 1;
+
+    if (!CRYPTO_THREAD_run_once(&oqsx_shared_once, oqsx_shared_init)
+            || oqsx_shared_lock == NULL
+            || !CRYPTO_THREAD_write_lock(oqsx_shared_lock))
+        return 0;
+    if (oqsx_shared_refs == 0) {
+        oqsx_shared_max = oqsx_keymgmt_count();
+        if ((oqsx_shared_algs = OPENSSL_zalloc(oqsx_shared_max * sizeof(*oqsx_shared_algs))) == NULL) {
+            ERR_raise(ERR_LIB_PROV, ERR_R_MALLOC_FAILURE);
+            ret = 0;
+            goto end;
+        }
+        oqsx_trace_start();
+    }
+    oqsx_shared_refs++;
+
+    end:
+    CRYPTO_THREAD_unlock(oqsx_shared_lock);
+    return ret;
+}
+
+void oqsx_shared_release(void)
+{
+    size_t i, n;
+
+    if (oqsx_shared_lock == NULL || !CRYPTO_THREAD_write_lock(oqsx_shared_lock))
+        return;
+    if (--oqsx_shared_refs == 0) {
+        oqsx_trace_stop();
+        n = atomic_load_explicit(&oqsx_shared_count, memory_order_relaxed);
+        atomic_store_explicit(&oqsx_shared_count, 0, memory_order_relaxed);
+        for (i = 0; i < n; i++) {
+            OQSX_SHARED_ALG *alg = &oqsx_shared_algs[i];
+
+            if (alg->is_kem)
+                OQS_KEM_free(alg->qs_ctx.kem);
+            else
+                OQS_SIG_free(alg->qs_ctx.sig);
+            OPENSSL_free(alg->aid);
+            OPENSSL_free(alg->oqs_name);
+        }
+        OPENSSL_free(oqsx_shared_algs);
+        oqsx_shared_algs = NULL;
+        oqsx_shared_max = 0;
+    }
+    CRYPTO_THREAD_unlock(oqsx_shared_lock);
+}
+
+static const OQSX_SHARED_ALG *oqsx_shared_find(const char *oqs_name, int is_kem, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        if (oqsx_shared_algs[i].is_kem == is_kem
+                && !strcmp(oqsx_shared_algs[i].oqs_name, oqs_name))
+            return &oqsx_shared_algs[i];
+    }
+    return NULL;
+}
+
+static int oqsx_shared_encode_aid(OQSX_SHARED_ALG *alg)
+{
+    const char *oid = oqsx_sig_oid(alg->oqs_name);
+    ASN1_OBJECT *obj = NULL;
+    int len;
+
+    if (oid == NULL || (obj = OBJ_txt2obj(oid, 1)) == NULL)
+        return 0;
+    len = i2d_ASN1_OBJECT(obj, &alg->aid);
+    ASN1_OBJECT_free(obj);
+    if (len <= 0)
+        return 0;
+    alg->aid_len = len;
+    return 1;
+}
+
+const OQSX_SHARED_ALG *oqsx_shared_alg(const char *oqs_name, int is_kem)
+{
+    const OQSX_SHARED_ALG *ret;
+    OQSX_SHARED_ALG *alg;
+    size_t n = atomic_load_explicit(&oqsx_shared_count, memory_order_acquire);
+
+    if (oqs_name == NULL)
+        return NULL;
+    if ((ret = oqsx_shared_find(oqs_name, is_kem, n)) != NULL)
+        return ret;
+
+    if (oqsx_shared_lock == NULL || !CRYPTO_THREAD_write_lock(oqsx_shared_lock))
+        return NULL;
+    n = atomic_load_explicit(&oqsx_shared_count, memory_order_relaxed);
+    if ((ret = oqsx_shared_find(oqs_name, is_kem, n)) != NULL)
+        goto end;
+    if (n == oqsx_shared_max) {
+        // only names from the key management table are ever looked up
+        ERR_raise_data(ERR_LIB_PROV, ERR_R_INTERNAL_ERROR,
+                       "no room to add %s to the shared algorithm store", oqs_name);
+        goto end;
+    }
+
+    alg = &oqsx_shared_algs[n];
+    alg->is_kem = is_kem;
+    alg->oqs_name = OPENSSL_strdup(oqs_name);
+    if (is_kem)
+        alg->qs_ctx.kem = OQS_KEM_new(oqs_name);
+    else
+        alg->qs_ctx.sig = OQS_SIG_new(oqs_name);
+    if (alg->oqs_name == NULL || alg->qs_ctx.kem == NULL) {
+        if (alg->oqs_name == NULL)
+            ERR_raise(ERR_LIB_PROV, ERR_R_MALLOC_FAILURE);
+        else
+            ERR_raise_data(ERR_LIB_PROV, ERR_R_UNSUPPORTED,
+                           "liboqs cannot instantiate %s", oqs_name);
+        if (is_kem)
+            OQS_KEM_free(alg->qs_ctx.kem);
+        else
+            OQS_SIG_free(alg->qs_ctx.sig);
+        OPENSSL_free(alg->oqs_name);
+        memset(alg, 0, sizeof(*alg));
+        goto end;
+    }
+    alg->backend = oqsx_backend_select(oqs_name, is_kem);
+    // not every signature has an OID; such contexts report no AID
+    if (!is_kem)
+        oqsx_shared_encode_aid(alg);
+    ret = alg;
+    atomic_store_explicit(&oqsx_shared_count, n + 1, memory_order_release);
+
+    end:
+    CRYPTO_THREAD_unlock(oqsx_shared_lock);
+    return ret;
+}
+
+int oqsx_shared_sig_aid(const char *oqs_name, const unsigned char **aid, size_t *aid_len)
+{
+    const OQSX_SHARED_ALG *alg = oqsx_shared_alg(oqs_name, 0);
+
+    if (alg == NULL || alg->aid == NULL)
+        return 0;
+    *aid = alg->aid;
+    *aid_len = alg->aid_len;
+    return 1;
+}
+
+/// Ephemeral reuse code
+
+static uint64_t oqsx_reuse_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int oqsx_reuse_configure(PROV_OQS_CTX *ctx, size_t max_uses, uint64_t max_ms)
+{
+    // a single use is no reuse; an unbounded window is not offered
+    if (max_uses < 2 || max_ms == 0)
+        return 1;
+    if ((ctx->reuse_lock = CRYPTO_THREAD_lock_new()) == NULL)
+        return 0;
+    ctx->reuse_max_uses = max_uses;
+    ctx->reuse_max_ms = max_ms;
+    return 1;
+}
+
+/* Returns a new key with a copy of the current material of src */
+static OQSX_KEY *oqsx_reuse_copy(OQSX_KEY *src)
+{
+    OQSX_KEY *key;
+    OQSX_KEY_PIN pin;
+
+    if ((key = oqsx_key_new(src->libctx, src->oqs_name, src->tls_name, src->keytype,
+                            src->propq)) == NULL)
+        return NULL;
+    if (oqsx_key_allocate_keymaterial(key)) {
+        oqsx_key_free(key);
+        return NULL;
+    }
+    oqsx_key_pin(src, &pin);
+    memcpy(key->privkey, pin.privkey, key->privkeylen);
+    memcpy(key->pubkey, pin.pubkey, key->pubkeylen);
+    atomic_store(&key->validated, atomic_load(pin.validated));
+    oqsx_key_unpin(src, &pin);
+    return key;
+}
+
+static int oqsx_reuse_matches(const OQSX_REUSE_SLOT *slot, int primitive, const char *tls_name)
+{
+    return slot->key != NULL && slot->key->keytype == primitive
+           && !strcmp(slot->key->tls_name, tls_name);
+}
+
+/*
+ * Returns a copy of the current key of the algorithm if it is still within
+ * its use and time limits, NULL if a fresh key is needed. Expired keys are
+ * dropped here.
+ */
+OQSX_KEY *oqsx_reuse_get(PROV_OQS_CTX *ctx, int primitive, const char *tls_name)
+{
+    OQSX_KEY *ret = NULL, *src = NULL, *expired = NULL;
+    OQSX_REUSE_SLOT *slot;
+    int i;
+
+    if (ctx->reuse_lock == NULL || primitive == KEY_TYPE_SIG || tls_name == NULL
+            || !CRYPTO_THREAD_write_lock(ctx->reuse_lock))
+        return NULL;
+    for (i = 0; i < OQSX_MAX_REUSE_SLOTS; i++) {
+        slot = &ctx->reuse[i];
+        if (!oqsx_reuse_matches(slot, primitive, tls_name))
+            continue;
+        if (slot->uses < ctx->reuse_max_uses
+                && oqsx_reuse_clock() - slot->born_ms < ctx->reuse_max_ms
+                && oqsx_key_up_ref(slot->key)) {
+            slot->uses++;
+            src = slot->key;
+        } else {
+            expired = slot->key;
+            slot->key = NULL;
+        }
+        break;
+    }
+    CRYPTO_THREAD_unlock(ctx->reuse_lock);
+
+    oqsx_key_free(expired);
+    if (src != NULL) {
+        ret = oqsx_reuse_copy(src);
+        oqsx_key_free(src);
+    }
+    if (ret != NULL)
+        oqsx_counter_add(&ctx->kem_reuses, 1);
+    return ret;
+}
+
+/* Makes a copy of a freshly generated KEM key the one oqsx_reuse_get copies */
+void oqsx_reuse_put(PROV_OQS_CTX *ctx, OQSX_KEY *key)
+{
+    OQSX_KEY *copy, *old = NULL;
+    OQSX_REUSE_SLOT *slot = NULL;
+    int i;
+
+    if (key->keytype == KEY_TYPE_SIG)
+        return;
+    oqsx_counter_add(&ctx->kem_keygens, 1);
+    if (ctx->reuse_lock == NULL || key->tls_name == NULL
+            || (copy = oqsx_reuse_copy(key)) == NULL)
+        return;
+    if (!CRYPTO_THREAD_write_lock(ctx->reuse_lock)) {
+        oqsx_key_free(copy);
+        return;
+    }
+    for (i = 0; i < OQSX_MAX_REUSE_SLOTS; i++) {
+        if (oqsx_reuse_matches(&ctx->reuse[i], key->keytype, key->tls_name)) {
+            slot = &ctx->reuse[i];
+            break;
+        }
+        if (slot == NULL && ctx->reuse[i].key == NULL)
+            slot = &ctx->reuse[i];
+    }
+    // with all slots taken by other algorithms this key is just not reused
+    if (slot != NULL) {
+        old = slot->key;
+        slot->key = copy;
+        slot->uses = 1;
+        slot->born_ms = oqsx_reuse_clock();
+    } else {
+        old = copy;
+    }
+    CRYPTO_THREAD_unlock(ctx->reuse_lock);
+    oqsx_key_free(old);
+}
+
+/// Deadline code
+
+/* Raises OQSPROV_R_DEADLINE_EXCEEDED if a set deadline has passed */
+int oqsx_deadline_passed(uint64_t deadline)
+{
+    struct timespec ts;
+
+    if (deadline == 0)
+        return 0;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    if ((uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000 < deadline)
+        return 0;
+    ERR_raise_data(ERR_LIB_PROV, OQSPROV_R_DEADLINE_EXCEEDED, "deadline exceeded");
+    return 1;
+}
+
+/// Scratch code
+
+int oqsx_scratch_set(OQSX_SCRATCH *scratch, const OSSL_PARAM *p)
+{
+    const void *buf = NULL;
+    size_t size = 0;
+
+    if (!OSSL_PARAM_get_octet_ptr(p, &buf, &size))
+        return 0;
+    scratch->buf = (unsigned char *)buf;
+    scratch->size = buf == NULL ? 0 : size;
+    scratch->used = 0;
+    return 1;
+}
+
+void *oqsx_scratch_alloc(OQSX_SCRATCH *scratch, size_t len)
+{
+    size_t alen = OQSX_SCRATCH_ROUND(len);
+    unsigned char *ret;
+
+    if (scratch->buf != NULL && alen <= scratch->size - scratch->used) {
+        ret = scratch->buf + scratch->used;
+        scratch->used += alen;
+        return ret;
+    }
+    return OPENSSL_secure_malloc(len);
+}
+
+void oqsx_scratch_free(OQSX_SCRATCH *scratch, void *ptr, size_t len)
+{
+    unsigned char *p = ptr;
+
+    if (p == NULL)
+        return;
+    if (scratch->buf != NULL && p >= scratch->buf && p < scratch->buf + scratch->size) {
+        OPENSSL_cleanse(p, len);
+        // blocks are released in reverse order of allocation
+        scratch->used = p - scratch->buf;
+        return;
+    }
+    OPENSSL_secure_clear_free(p, len);
 }
 
 /// Key code
 
 static const OQSX_KEX_INFO nids_ecp[] = {
-        { EVP_PKEY_EC, NID_X9_62_prime256v1, 0, 65 , 121, 32}, // level 1
-        { EVP_PKEY_EC, NID_X9_62_prime256v1, 0, 65 , 121, 32}, // level 2
-        { EVP_PKEY_EC, NID_secp384r1       , 0, 97 , 167, 48}, // level 3
-        { EVP_PKEY_EC, NID_secp384r1       , 0, 97 , 167, 48}, // level 4
-        { EVP_PKEY_EC, NID_secp521r1       , 0, 133, 223, 66}  // level 5
+        { EVP_PKEY_EC, NID_X9_62_prime256v1, 0, 65 , 121, 32, "p256_"}, // level 1
+        { EVP_PKEY_EC, NID_X9_62_prime256v1, 0, 65 , 121, 32, "p256_"}, // level 2
+        { EVP_PKEY_EC, NID_secp384r1       , 0, 97 , 167, 48, "p384_"}, // level 3
+        { EVP_PKEY_EC, NID_secp384r1       , 0, 97 , 167, 48, "p384_"}, // level 4
+        { EVP_PKEY_EC, NID_secp521r1       , 0, 133, 223, 66, "p521_"}  // level 5
 };
 
 static const OQSX_KEX_INFO nids_ecx[] = {
-        { EVP_PKEY_X25519, 0, 1, 32, 32, 32}, // level 1
-        { EVP_PKEY_X25519, 0, 1, 32, 32, 32}, // level 2
-        { EVP_PKEY_X448,   0, 1, 56, 56, 56}, // level 3
-        { EVP_PKEY_X448,   0, 1, 56, 56, 56}, // level 4
-        { 0,               0, 0,  0,  0,  0}  // level 5
+        { EVP_PKEY_X25519, 0, 1, 32, 32, 32, "x25519_"}, // level 1
+        { EVP_PKEY_X25519, 0, 1, 32, 32, 32, "x25519_"}, // level 2
+        { EVP_PKEY_X448,   0, 1, 56, 56, 56, "x448_"  }, // level 3
+        { EVP_PKEY_X448,   0, 1, 56, 56, 56, "x448_"  }, // level 4
+        { 0,               0, 0,  0,  0,  0, ""       }  // level 5
 };
 
-static int oqshybkem_init_ecp(int nistlevel, OQSX_EVP_CTX *evp_ctx)
+static EVP_PKEY *oqshybkem_params_ecp(const OQSX_KEX_INFO *kex_info)
 {
     int ret = 1;
 
-    evp_ctx->kex_info = &nids_ecp[nistlevel - 1];
+    // Free at err:
+    EVP_PKEY_CTX *kex = NULL;
+    EVP_PKEY *kexParam = NULL;
 
-    evp_ctx->kex = EVP_PKEY_CTX_new_id(evp_ctx->kex_info->nid_kex, NULL);
-    ON_ERR_GOTO(!evp_ctx->kex, err);
+    kex = EVP_PKEY_CTX_new_id(kex_info->nid_kex, NULL);
+    ON_ERR_GOTO(!kex, err);
 
-    ret = EVP_PKEY_paramgen_init(evp_ctx->kex);
+    ret = EVP_PKEY_paramgen_init(kex);
     ON_ERR_GOTO(ret <= 0, err);
 
-    ret = EVP_PKEY_CTX_set_ec_paramgen_curve_nid(evp_ctx->kex, evp_ctx->kex_info->nid_kex_crv);
+    ret = EVP_PKEY_CTX_set_ec_paramgen_curve_nid(kex, kex_info->nid_kex_crv);
     ON_ERR_GOTO(ret <= 0, err);
 
-    ret = EVP_PKEY_paramgen(evp_ctx->kex, &evp_ctx->kexParam);
-    ON_ERR_GOTO(ret <= 0 || !evp_ctx->kexParam, err);
+    ret = EVP_PKEY_paramgen(kex, &kexParam);
+    ON_ERR_GOTO(ret <= 0 || !kexParam, err);
 
     err:
-    return ret;
+    EVP_PKEY_CTX_free(kex);
+    return kexParam;
 }
 
-static int oqshybkem_init_ecx(int nistlevel, OQSX_EVP_CTX *evp_ctx)
+static EVP_PKEY *oqshybkem_params_ecx(const OQSX_KEX_INFO *kex_info)
 {
-    int ret = 1;
+    EVP_PKEY *kexParam = EVP_PKEY_new();
 
-    evp_ctx->kex_info = &nids_ecx[nistlevel - 1];
+    ON_ERR_GOTO(!kexParam, err);
+    if (EVP_PKEY_set_type(kexParam, kex_info->nid_kex) <= 0) {
+        EVP_PKEY_free(kexParam);
+        kexParam = NULL;
+    }
 
-    evp_ctx->kexParam = EVP_PKEY_new();
-    ON_ERR_SET_GOTO(!evp_ctx->kexParam, ret, -1, err);
+    err:
+    return kexParam;
+}
 
-    ret = EVP_PKEY_set_type(evp_ctx->kexParam, evp_ctx->kex_info->nid_kex);
-    ON_ERR_SET_GOTO(ret <= 0, ret, -1, err);
+static int oqshybkem_init_ecp(int nistlevel, OQSX_EVP_CTX *evp_ctx)
+{
+    evp_ctx->kex_info = &nids_ecp[nistlevel - 1];
+    evp_ctx->new_kexParam = oqshybkem_params_ecp;
+    return 1;
+}
 
-    evp_ctx->kex = EVP_PKEY_CTX_new(evp_ctx->kexParam, NULL);
-    ON_ERR_SET_GOTO(!evp_ctx->kex, ret, -1, err);
+static int oqshybkem_init_ecx(int nistlevel, OQSX_EVP_CTX *evp_ctx)
+{
+    evp_ctx->kex_info = &nids_ecx[nistlevel - 1];
+    evp_ctx->new_kexParam = oqshybkem_params_ecx;
+    return 1;
+}
 
-    err:
-    return ret;
+/*
+ * Returns the EVP parameters of a classical component, creating them on the
+ * first call. Racing first calls each create them; one set is kept.
+ */
+EVP_PKEY *oqsx_evp_ctx_params(const OQSX_EVP_CTX *evp_ctx)
+{
+    // lazily filled in, so not const
+    OQSX_EVP_CTX *ctx = (OQSX_EVP_CTX *)evp_ctx;
+    EVP_PKEY *kexParam = atomic_load(&ctx->kexParam), *expected = NULL;
+
+    if (kexParam != NULL)
+        return kexParam;
+    if ((kexParam = ctx->new_kexParam(ctx->kex_info)) == NULL)
+        return NULL;
+    if (!atomic_compare_exchange_strong(&ctx->kexParam, &expected, kexParam)) {
+        EVP_PKEY_free(kexParam);
+        kexParam = expected;
+    }
+    return kexParam;
 }
 
 static const int (*init_kex_fun[])(int, OQSX_EVP_CTX *) = {
@@ -97,18 +539,85 @@ static const int (*init_kex_fun[])(int, OQSX_EVP_CTX *) = {
         oqshybkem_init_ecx
 };
 
+/*
+ * Appends a component to a KEM layout, placing its slices right after those
+ * of the previous components.
+ */
+static OQSX_KEM_COMP *oqsx_kem_layout_add(OQSX_KEM_LAYOUT *layout,
+                                          size_t pubkeylen, size_t privkeylen,
+                                          size_t ctlen, size_t secretlen)
+{
+    OQSX_KEM_COMP *comp;
+
+    if (layout->numcomps == OQSX_MAX_KEM_COMPONENTS)
+        return NULL;
+    comp = &layout->comps[layout->numcomps++];
+    comp->pubkey_off = layout->pubkeylen;
+    comp->pubkeylen = pubkeylen;
+    comp->privkey_off = layout->privkeylen;
+    comp->privkeylen = privkeylen;
+    comp->ct_off = layout->ctlen;
+    comp->ctlen = ctlen;
+    comp->secret_off = layout->secretlen;
+    comp->secretlen = secretlen;
+    layout->pubkeylen += pubkeylen;
+    layout->privkeylen += privkeylen;
+    layout->ctlen += ctlen;
+    layout->secretlen += secretlen;
+    return comp;
+}
+
+static int oqsx_kem_layout_add_oqs(OQSX_KEM_LAYOUT *layout, const OQS_KEM *kem)
+{
+    OQSX_KEM_COMP *comp = oqsx_kem_layout_add(layout, kem->length_public_key,
+                                              kem->length_secret_key,
+                                              kem->length_ciphertext,
+                                              kem->length_shared_secret);
+
+    if (comp == NULL)
+        return 0;
+    comp->is_evp = 0;
+    comp->ctx.kem = kem;
+    return 1;
+}
+
+/* The classical ciphertext is the encoded ephemeral public key */
+static int oqsx_kem_layout_add_evp(OQSX_KEM_LAYOUT *layout, const OQSX_EVP_CTX *evp)
+{
+    const OQSX_KEX_INFO *kex_info = evp->kex_info;
+    OQSX_KEM_COMP *comp = oqsx_kem_layout_add(layout, kex_info->kex_length_public_key,
+                                              kex_info->kex_length_private_key,
+                                              kex_info->kex_length_public_key,
+                                              kex_info->kex_length_secret);
+
+    if (comp == NULL)
+        return 0;
+    comp->is_evp = 1;
+    comp->ctx.evp = evp;
+    return 1;
+}
+
+static OQSX_COUNTER oqsx_live_keys;
+
+size_t oqsx_key_live_count(void)
+{
+    return (size_t)oqsx_counter_read(&oqsx_live_keys);
+}
+
 OQSX_KEY *oqsx_key_new(OSSL_LIB_CTX *libctx, char* oqs_name, char* tls_name, int primitive, const char *propq)
 {
     OQSX_KEY *ret = OPENSSL_zalloc(sizeof(*ret));
+    const OQSX_SHARED_ALG *alg = oqsx_shared_alg(oqs_name, primitive != KEY_TYPE_SIG);
     int ret2 = 0;
 
     if (ret == NULL) goto err;
+    ON_ERR_GOTO(!alg, err);
 
     if (primitive == KEY_TYPE_SIG) {
         ret->numkeys = 1;
         ret->comp_privkey = OPENSSL_malloc(sizeof(void *));
         ret->comp_pubkey = OPENSSL_malloc(sizeof(void *));
-        ret->oqsx_provider_ctx.oqsx_qs_ctx.sig = OQS_SIG_new(oqs_name);
+        ret->oqsx_provider_ctx.oqsx_qs_ctx.sig = alg->qs_ctx.sig;
         ret->privkeylen = ret->oqsx_provider_ctx.oqsx_qs_ctx.sig->length_secret_key;
         ret->pubkeylen = ret->oqsx_provider_ctx.oqsx_qs_ctx.sig->length_public_key;
         ret->keytype = KEY_TYPE_SIG;
@@ -116,29 +625,35 @@ OQSX_KEY *oqsx_key_new(OSSL_LIB_CTX *libctx, char* oqs_name, char* tls_name, int
         ret->numkeys = 1;
         ret->comp_privkey = OPENSSL_malloc(sizeof(void *));
         ret->comp_pubkey = OPENSSL_malloc(sizeof(void *));
-        ret->oqsx_provider_ctx.oqsx_qs_ctx.kem = OQS_KEM_new(oqs_name);
-        ret->privkeylen = ret->oqsx_provider_ctx.oqsx_qs_ctx.kem->length_secret_key;
-        ret->pubkeylen = ret->oqsx_provider_ctx.oqsx_qs_ctx.kem->length_public_key;
+        ret->oqsx_provider_ctx.oqsx_qs_ctx.kem = alg->qs_ctx.kem;
+        ON_ERR_GOTO(!oqsx_kem_layout_add_oqs(&ret->kem_layout, alg->qs_ctx.kem), err);
+        ret->privkeylen = ret->kem_layout.privkeylen;
+        ret->pubkeylen = ret->kem_layout.pubkeylen;
         ret->keytype = KEY_TYPE_KEM;
     } else if (primitive == KEY_TYPE_ECX_HYB_KEM || primitive == KEY_TYPE_ECP_HYB_KEM) {
-        ret->oqsx_provider_ctx.oqsx_qs_ctx.kem = OQS_KEM_new(oqs_name);
-        ON_ERR_GOTO(!ret->oqsx_provider_ctx.oqsx_qs_ctx.kem, err);
+        ret->oqsx_provider_ctx.oqsx_qs_ctx.kem = alg->qs_ctx.kem;
         OQSX_EVP_CTX *evp_ctx = OPENSSL_zalloc(sizeof(OQSX_EVP_CTX));
         ON_ERR_GOTO(!evp_ctx, err);
 
         ret2 = (init_kex_fun[primitive - KEY_TYPE_ECP_HYB_KEM])
                 (ret->oqsx_provider_ctx.oqsx_qs_ctx.kem->claimed_nist_level, evp_ctx);
-        ON_ERR_GOTO(ret2 <= 0 || !evp_ctx->kexParam || !evp_ctx->kex, err);
+        ON_ERR_GOTO(ret2 <= 0, err);
 
-        ret->numkeys = 2;
-        ret->comp_privkey = OPENSSL_malloc(2 * sizeof(void *));
-        ret->comp_pubkey = OPENSSL_malloc(2 * sizeof(void *));
-        ret->privkeylen = ret->oqsx_provider_ctx.oqsx_qs_ctx.kem->length_secret_key + evp_ctx->kex_info->kex_length_private_key;
-        ret->pubkeylen = ret->oqsx_provider_ctx.oqsx_qs_ctx.kem->length_public_key + evp_ctx->kex_info->kex_length_public_key;
         ret->oqsx_provider_ctx.oqsx_evp_ctx = evp_ctx;
+        ON_ERR_GOTO(!oqsx_kem_layout_add_evp(&ret->kem_layout, evp_ctx), err);
+        ON_ERR_GOTO(!oqsx_kem_layout_add_oqs(&ret->kem_layout, alg->qs_ctx.kem), err);
+
+        ret->numkeys = ret->kem_layout.numcomps;
+        ret->comp_privkey = OPENSSL_malloc(ret->numkeys * sizeof(void *));
+        ret->comp_pubkey = OPENSSL_malloc(ret->numkeys * sizeof(void *));
+        ret->privkeylen = ret->kem_layout.privkeylen;
+        ret->pubkeylen = ret->kem_layout.pubkeylen;
         ret->keytype = primitive;
     } else goto err;
 
+    ret->backend = alg->backend;
+    // shared like the liboqs descriptors, see oqsx_shared_alg
+    ret->oqs_name = alg->oqs_name;
     ret->libctx = libctx;
     ret->references = 1;
     ret->tls_name = OPENSSL_strdup(tls_name);
@@ -150,6 +665,7 @@ OQSX_KEY *oqsx_key_new(OSSL_LIB_CTX *libctx, char* oqs_name, char* tls_name, int
             goto err;
     }
 
+    oqsx_counter_add(&oqsx_live_keys, 1);
     return ret;
 err:
     ERR_raise(ERR_LIB_EC, ERR_R_MALLOC_FAILURE);
@@ -159,6 +675,7 @@ err:
 
 void oqsx_key_free(OQSX_KEY *key)
 {
+    OQSX_KEY_BODY *body;
     int refcnt;
 
     if (key == NULL)
@@ -178,20 +695,21 @@ void oqsx_key_free(OQSX_KEY *key)
 #endif
 
     OPENSSL_free(key->propq);
-    OPENSSL_secure_clear_free(key->privkey, key->privkeylen);
+    OPENSSL_free(key->tls_name);
+    body = atomic_load(&key->body);
+    if (body != NULL)
+        oqsx_arena_clear_free(body, body->len);
+    oqsx_arena_clear_free(key->privkey, key->privkeylen);
     OPENSSL_secure_clear_free(key->pubkey, key->pubkeylen);
     OPENSSL_free(key->comp_pubkey);
     OPENSSL_free(key->comp_privkey);
-    if (key->keytype == KEY_TYPE_KEM)
-        OQS_KEM_free(key->oqsx_provider_ctx.oqsx_qs_ctx.kem);
-    else if (key->keytype == KEY_TYPE_ECP_HYB_KEM || key->keytype == KEY_TYPE_ECX_HYB_KEM) {
-        OQS_KEM_free(key->oqsx_provider_ctx.oqsx_qs_ctx.kem);
-        EVP_PKEY_CTX_free(key->oqsx_provider_ctx.oqsx_evp_ctx->kex);
-        EVP_PKEY_free(key->oqsx_provider_ctx.oqsx_evp_ctx->kexParam);
+    // liboqs descriptors are shared (see oqsx_shared_alg), not owned by the key
+    if (key->keytype == KEY_TYPE_ECP_HYB_KEM || key->keytype == KEY_TYPE_ECX_HYB_KEM) {
+        EVP_PKEY_free(atomic_load(&key->oqsx_provider_ctx.oqsx_evp_ctx->kexParam));
         OPENSSL_free(key->oqsx_provider_ctx.oqsx_evp_ctx);
-    } else
-        OQS_SIG_free(key->oqsx_provider_ctx.oqsx_qs_ctx.sig);
+    }
     OPENSSL_free(key);
+    oqsx_counter_add(&oqsx_live_keys, -1);
 }
 
 int oqsx_key_up_ref(OQSX_KEY *key)
@@ -212,7 +730,7 @@ int oqsx_key_allocate_keymaterial(OQSX_KEY *key)
     int ret = 0;
 
     if (!key->privkey) {
-        key->privkey = OPENSSL_secure_zalloc(key->privkeylen);
+        key->privkey = oqsx_arena_zalloc(key->privkeylen);
         ON_ERR_SET_GOTO(!key->privkey, ret, 1, err);
     }
     if (!key->pubkey) {
@@ -227,14 +745,20 @@ int oqsx_key_fromdata(OQSX_KEY *key, const OSSL_PARAM params[], int include_priv
 {
     const OSSL_PARAM *p;
 
+    // rotated keys only take new material through oqsx_key_rotate
+    if (atomic_load(&key->body) != NULL) {
+        ERR_raise(ERR_LIB_PROV, ERR_R_PASSED_INVALID_ARGUMENT);
+        return 0;
+    }
+
     p = OSSL_PARAM_locate_const(params, OSSL_PKEY_PARAM_PRIV_KEY);
     if (p != NULL) {
         if (p->data_type != OSSL_PARAM_OCTET_STRING) {
             printf("invalid data type\n");
             return 0;
         }
-        OPENSSL_secure_clear_free(key->privkey, key->privkeylen);
-        key->privkey = OPENSSL_secure_malloc(p->data_size);
+        oqsx_arena_clear_free(key->privkey, key->privkeylen);
+        key->privkey = oqsx_arena_zalloc(p->data_size);
         if (key->privkey == NULL) {
             ERR_raise(ERR_LIB_PROV, ERR_R_MALLOC_FAILURE);
             return 0;
@@ -257,46 +781,41 @@ int oqsx_key_fromdata(OQSX_KEY *key, const OSSL_PARAM params[], int include_priv
         memcpy(key->pubkey, p->data, p->data_size);
         key->pubkeylen = p->data_size;
     }
+    oqsx_key_set_validated(key, 0);
     return 1;
 }
 
-static int oqsx_key_gen_oqs_kem(OQS_KEM *ctx, unsigned char *pubkey, unsigned char *privkey)
+static int oqsx_key_gen_oqs_kem(const OQSX_BACKEND *backend, const OQS_KEM *ctx,
+                                unsigned char *pubkey, unsigned char *privkey)
 {
-    return OQS_KEM_keypair(ctx, pubkey, privkey);
+    return backend->kem_keypair(ctx, pubkey, privkey);
 }
 
-static int oqsx_key_gen_oqs_sig(OQS_SIG *ctx, unsigned char *pubkey, unsigned char *privkey)
+static int oqsx_key_gen_oqs_sig(const OQSX_BACKEND *backend, const OQS_SIG *ctx,
+                                unsigned char *pubkey, unsigned char *privkey)
 {
-    return OQS_SIG_keypair(ctx, pubkey, privkey);
+    return backend->sig_keypair(ctx, pubkey, privkey);
 }
 
-static int oqsx_key_gen_evp_kex(OQSX_EVP_CTX *ctx, unsigned char *pubkey, unsigned char *privkey)
+static int oqsx_key_encode_evp_kex(const OQSX_EVP_CTX *ctx, EVP_PKEY *pkey, unsigned char *pubkey, unsigned char *privkey)
 {
     int ret = 0, ret2 = 0;
 
     // Free at errhyb:
-    EVP_PKEY_CTX *kgctx = NULL;
-    EVP_PKEY *pkey = NULL;
     unsigned char *pubkeykex_encoded = NULL;
 
     size_t privkeykexlen = 0;
     size_t pubkeykexlen = 0;
 
-    kgctx = EVP_PKEY_CTX_new(ctx->kexParam, NULL);
-    ON_ERR_SET_GOTO(!kgctx, ret, -1, errhyb);
-
-    ret2 = EVP_PKEY_keygen_init(kgctx);
-    ON_ERR_SET_GOTO(ret2 <= 0, ret, -1, errhyb);
-    ret2 = EVP_PKEY_keygen(kgctx, &pkey);
-    ON_ERR_SET_GOTO(ret2 <= 0, ret, -1, errhyb);
-
     // TODO: If available, use preallocated memory
     pubkeykexlen = EVP_PKEY_get1_encoded_public_key(pkey, &pubkeykex_encoded);
     ON_ERR_SET_GOTO(pubkeykexlen <= 0 || !pubkeykex_encoded, ret, -1, errhyb);
+    ON_ERR_SET_GOTO(pubkeykexlen != ctx->kex_info->kex_length_public_key, ret, -1, errhyb);
 
     memcpy(pubkey, pubkeykex_encoded, pubkeykexlen);
 
     if (ctx->kex_info->raw_key_support) {
+        privkeykexlen = ctx->kex_info->kex_length_private_key;
         ret2 = EVP_PKEY_get_raw_private_key(pkey, privkey, &privkeykexlen);
         ON_ERR_SET_GOTO(ret2 <= 0, ret, -1, errhyb);
     } else {
@@ -314,45 +833,137 @@ static int oqsx_key_gen_evp_kex(OQSX_EVP_CTX *ctx, unsigned char *pubkey, unsign
         OPENSSL_clear_free(pkey_enc, privkeykexlen);
     }
 
+    errhyb:
+    OPENSSL_free(pubkeykex_encoded);
+
+    return ret;
+}
+
+static int oqsx_key_gen_evp_kex(const OQSX_EVP_CTX *ctx, unsigned char *pubkey, unsigned char *privkey)
+{
+    int ret = 0, ret2 = 0;
+
+    // Free at errhyb:
+    EVP_PKEY_CTX *kgctx = NULL;
+    EVP_PKEY *pkey = NULL, *kexParam = oqsx_evp_ctx_params(ctx);
+
+    ON_ERR_SET_GOTO(!kexParam, ret, -1, errhyb);
+    kgctx = EVP_PKEY_CTX_new(kexParam, NULL);
+    ON_ERR_SET_GOTO(!kgctx, ret, -1, errhyb);
+
+    ret2 = EVP_PKEY_keygen_init(kgctx);
+    ON_ERR_SET_GOTO(ret2 <= 0, ret, -1, errhyb);
+    ret2 = EVP_PKEY_keygen(kgctx, &pkey);
+    ON_ERR_SET_GOTO(ret2 <= 0, ret, -1, errhyb);
+
+    ret = oqsx_key_encode_evp_kex(ctx, pkey, pubkey, privkey);
+
     errhyb:
     EVP_PKEY_CTX_free(kgctx);
     EVP_PKEY_free(pkey);
-    OPENSSL_free(pubkeykex_encoded);
 
     return ret;
 }
 
-int oqsx_key_gen(OQSX_KEY *key)
+/*
+ * Reads the leading (classical) component of an octet string key parameter
+ * of a hybrid sibling key.
+ */
+static int oqsx_key_copy_hyb_component(const EVP_PKEY *sibling, const char *param,
+                                       unsigned char *out, size_t outlen)
 {
     int ret = 0;
+    unsigned char *buf = NULL;
+    size_t buflen = 0;
+
+    ON_ERR_GOTO(!EVP_PKEY_get_octet_string_param(sibling, param, NULL, 0, &buflen), err);
+    ON_ERR_GOTO(buflen <= outlen, err);
+    buf = OPENSSL_secure_malloc(buflen);
+    ON_ERR_GOTO(!buf, err);
+    ON_ERR_GOTO(!EVP_PKEY_get_octet_string_param(sibling, param, buf, buflen, &buflen), err);
+    memcpy(out, buf, outlen);
+    ret = 1;
+
+    err:
+    OPENSSL_secure_clear_free(buf, buflen);
+    return ret;
+}
+
+/*
+ * Takes over the classical keypair of a sibling key instead of generating a
+ * fresh one. The sibling is either a plain classical key of the same type
+ * (and curve) or a hybrid key of this provider with the same classical part.
+ */
+static int oqsx_key_copy_evp_kex(const OQSX_EVP_CTX *ctx, EVP_PKEY *sibling, unsigned char *pubkey, unsigned char *privkey)
+{
+    const OQSX_KEX_INFO *kex_info = ctx->kex_info;
+    const char *type_name = EVP_PKEY_get0_type_name(sibling);
+    char group[80];
+    int nid;
+
+    if (EVP_PKEY_is_a(sibling, OBJ_nid2sn(kex_info->nid_kex))) {
+        if (kex_info->nid_kex_crv != 0) {
+            if (!EVP_PKEY_get_group_name(sibling, group, sizeof(group), NULL))
+                return -1;
+            if ((nid = OBJ_txt2nid(group)) == NID_undef)
+                nid = EC_curve_nist2nid(group);
+            if (nid != kex_info->nid_kex_crv)
+                return -1;
+        }
+        return oqsx_key_encode_evp_kex(ctx, sibling, pubkey, privkey);
+    }
+
+    if (type_name != NULL
+            && !strncmp(type_name, kex_info->hyb_prefix, strlen(kex_info->hyb_prefix))
+            && oqsx_key_copy_hyb_component(sibling, OSSL_PKEY_PARAM_PUB_KEY, pubkey, kex_info->kex_length_public_key)
+            && oqsx_key_copy_hyb_component(sibling, OSSL_PKEY_PARAM_PRIV_KEY, privkey, kex_info->kex_length_private_key))
+        return 0;
+
+    return -1;
+}
+
+int oqsx_key_gen(OQSX_KEY *key)
+{
+    return oqsx_key_gen_shared(key, NULL);
+}
+
+int oqsx_key_gen_shared(OQSX_KEY *key, EVP_PKEY *classical)
+{
+    int ret = 0, copied = 0;
 
     if (key->privkey == NULL || key->pubkey == NULL) {
         ret = oqsx_key_allocate_keymaterial(key);
         ON_ERR_GOTO(ret, err);
     }
 
-    if (key->keytype == KEY_TYPE_KEM) {
-        key->comp_privkey[0] = key->privkey;
-        key->comp_pubkey[0] = key->pubkey;
-        ret = oqsx_key_gen_oqs_kem(key->oqsx_provider_ctx.oqsx_qs_ctx.kem, key->comp_pubkey[0], key->comp_privkey[0]);
-        ON_ERR_GOTO(ret, err);
-    } else if (key->keytype == KEY_TYPE_ECP_HYB_KEM || key->keytype == KEY_TYPE_ECX_HYB_KEM) {
-        key->comp_privkey[0] = key->privkey;
-        key->comp_pubkey[0] = key->pubkey;
-        key->comp_privkey[1] = key->privkey + key->oqsx_provider_ctx.oqsx_evp_ctx->kex_info->kex_length_private_key;
-        key->comp_pubkey[1] = key->pubkey + key->oqsx_provider_ctx.oqsx_evp_ctx->kex_info->kex_length_public_key;
-        ret = oqsx_key_gen_evp_kex(key->oqsx_provider_ctx.oqsx_evp_ctx, key->comp_pubkey[0], key->comp_privkey[0]);
-        ON_ERR_GOTO(ret, err);
-        ret = oqsx_key_gen_oqs_kem(key->oqsx_provider_ctx.oqsx_qs_ctx.kem, key->comp_pubkey[1], key->comp_privkey[1]);
-        ON_ERR_GOTO(ret, err);
+    if (key->keytype == KEY_TYPE_KEM || key->keytype == KEY_TYPE_ECP_HYB_KEM
+            || key->keytype == KEY_TYPE_ECX_HYB_KEM) {
+        size_t i;
+
+        for (i = 0; i < key->kem_layout.numcomps; i++) {
+            const OQSX_KEM_COMP *comp = &key->kem_layout.comps[i];
+
+            key->comp_privkey[i] = (unsigned char *)key->privkey + comp->privkey_off;
+            key->comp_pubkey[i] = (unsigned char *)key->pubkey + comp->pubkey_off;
+            if (!comp->is_evp)
+                ret = oqsx_key_gen_oqs_kem(key->backend, comp->ctx.kem, key->comp_pubkey[i], key->comp_privkey[i]);
+            else if ((copied = classical != NULL))
+                ret = oqsx_key_copy_evp_kex(comp->ctx.evp, classical, key->comp_pubkey[i], key->comp_privkey[i]);
+            else
+                ret = oqsx_key_gen_evp_kex(comp->ctx.evp, key->comp_pubkey[i], key->comp_privkey[i]);
+            ON_ERR_GOTO(ret, err);
+        }
     } else if (key->keytype == KEY_TYPE_SIG) {
         key->comp_privkey[0] = key->privkey;
         key->comp_pubkey[0] = key->pubkey;
-        ret = oqsx_key_gen_oqs_sig(key->oqsx_provider_ctx.oqsx_qs_ctx.sig, key->pubkey, key->privkey);
+        ret = oqsx_key_gen_oqs_sig(key->backend, key->oqsx_provider_ctx.oqsx_qs_ctx.sig, key->pubkey, key->privkey);
         ON_ERR_GOTO(ret, err);
     } else {
         ret = 1;
     }
+    // freshly generated material needs no validation; a copied half was never checked
+    if (ret == 0)
+        oqsx_key_set_validated(key, copied ? 0 : OQSX_KEY_VALID_PUBLIC | OQSX_KEY_VALID_PRIVATE);
     err:
     return ret;
 }
@@ -366,9 +977,211 @@ int oqsx_key_parambits(OQSX_KEY *key) {
 }
 
 int oqsx_key_maxsize(OQSX_KEY *key) {
-    if (key->keytype == KEY_TYPE_KEM)
-        return key->oqsx_provider_ctx.oqsx_qs_ctx.kem->length_shared_secret;
-    else if (key->keytype == KEY_TYPE_ECP_HYB_KEM || key->keytype == KEY_TYPE_ECX_HYB_KEM)
-        return key->oqsx_provider_ctx.oqsx_evp_ctx->kex_info->kex_length_secret + key->oqsx_provider_ctx.oqsx_qs_ctx.kem->length_shared_secret;
+    if (key->keytype == KEY_TYPE_KEM || key->keytype == KEY_TYPE_ECP_HYB_KEM
+            || key->keytype == KEY_TYPE_ECX_HYB_KEM)
+        return key->kem_layout.secretlen;
     else return key->oqsx_provider_ctx.oqsx_qs_ctx.sig->length_signature;
 }
+
+/// Key validation code
+
+/*
+ * Kyber public keys are k polynomials of 256 coefficients packed as 12 bit
+ * values, followed by a 32 byte seed; every coefficient must be below q.
+ */
+#define OQSX_KYBER_Q 3329
+#define OQSX_KYBER_POLYBYTES 384
+#define OQSX_KYBER_SEEDBYTES 32
+
+static int oqsx_key_check_kyber_pub(const unsigned char *pubkey, size_t pubkeylen)
+{
+    size_t i, len = pubkeylen - OQSX_KYBER_SEEDBYTES;
+    unsigned int c0, c1, bad = 0;
+
+    if (pubkeylen < OQSX_KYBER_SEEDBYTES || len % OQSX_KYBER_POLYBYTES != 0)
+        return 0;
+    for (i = 0; i < len; i += 3) {
+        c0 = pubkey[i] | ((unsigned int)(pubkey[i + 1] & 0x0f) << 8);
+        c1 = (pubkey[i + 1] >> 4) | ((unsigned int)pubkey[i + 2] << 4);
+        bad |= (c0 >= OQSX_KYBER_Q) | (c1 >= OQSX_KYBER_Q);
+    }
+    return !bad;
+}
+
+static int oqsx_key_check_oqs_kem_pub(const OQS_KEM *kem, const unsigned char *pubkey)
+{
+    if (!strncmp(kem->method_name, "Kyber", 5))
+        return oqsx_key_check_kyber_pub(pubkey, kem->length_public_key);
+    // no public structure to check for the other KEMs at this layer
+    return 1;
+}
+
+static int oqsx_key_check_evp_pub(const OQSX_KEY *key, const OQSX_EVP_CTX *evp_ctx,
+                                  const unsigned char *pubkey)
+{
+    EVP_PKEY_CTX *ctx = NULL;
+    EVP_PKEY *pkey = NULL, *kexParam;
+    int ret = 0;
+
+    // every string of the right length is an X25519/X448 public key
+    if (evp_ctx->kex_info->raw_key_support)
+        return 1;
+    if ((kexParam = oqsx_evp_ctx_params(evp_ctx)) != NULL
+            && (pkey = EVP_PKEY_new()) != NULL
+            && EVP_PKEY_copy_parameters(pkey, kexParam) > 0
+            && EVP_PKEY_set1_encoded_public_key(pkey, pubkey,
+                                                evp_ctx->kex_info->kex_length_public_key) > 0
+            && (ctx = EVP_PKEY_CTX_new_from_pkey(key->libctx, pkey, key->propq)) != NULL)
+        ret = EVP_PKEY_public_check(ctx) > 0;
+    EVP_PKEY_CTX_free(ctx);
+    EVP_PKEY_free(pkey);
+    return ret;
+}
+
+static int oqsx_key_check_pub(const OQSX_KEY *key, const unsigned char *pubkey)
+{
+    const OQSX_KEM_COMP *comp;
+    size_t i;
+
+    if (key->keytype == KEY_TYPE_SIG)
+        return 1;
+    for (i = 0; i < key->kem_layout.numcomps; i++) {
+        comp = &key->kem_layout.comps[i];
+        if (comp->is_evp ? !oqsx_key_check_evp_pub(key, comp->ctx.evp, pubkey + comp->pubkey_off)
+                         : !oqsx_key_check_oqs_kem_pub(comp->ctx.kem, pubkey + comp->pubkey_off))
+            return 0;
+    }
+    return 1;
+}
+
+void oqsx_key_set_validated(OQSX_KEY *key, int validated)
+{
+    OQSX_KEY_PIN pin;
+
+    oqsx_key_pin(key, &pin);
+    atomic_store(pin.validated, validated);
+    oqsx_key_unpin(key, &pin);
+}
+
+int oqsx_key_validate(OQSX_KEY *key, int selection, int checktype)
+{
+    OQSX_KEY_PIN pin;
+    size_t pubkeylen, privkeylen;
+    int want = 0, ret = 1;
+
+    if ((selection & OSSL_KEYMGMT_SELECT_PUBLIC_KEY) != 0)
+        want |= OQSX_KEY_VALID_PUBLIC;
+    if ((selection & OSSL_KEYMGMT_SELECT_PRIVATE_KEY) != 0)
+        want |= OQSX_KEY_VALID_PRIVATE;
+
+    if (key->keytype == KEY_TYPE_SIG) {
+        pubkeylen = key->oqsx_provider_ctx.oqsx_qs_ctx.sig->length_public_key;
+        privkeylen = key->oqsx_provider_ctx.oqsx_qs_ctx.sig->length_secret_key;
+    } else {
+        pubkeylen = key->kem_layout.pubkeylen;
+        privkeylen = key->kem_layout.privkeylen;
+    }
+
+    oqsx_key_pin(key, &pin);
+    if (checktype == OSSL_KEYMGMT_VALIDATE_FULL_CHECK
+            && (atomic_load(pin.validated) & want) == want)
+        goto end;
+    if ((want & OQSX_KEY_VALID_PUBLIC) != 0) {
+        ret = pin.pubkey != NULL && key->pubkeylen == pubkeylen;
+        if (ret && checktype == OSSL_KEYMGMT_VALIDATE_FULL_CHECK)
+            ret = oqsx_key_check_pub(key, pin.pubkey);
+    }
+    if (ret && (want & OQSX_KEY_VALID_PRIVATE) != 0)
+        ret = pin.privkey != NULL && key->privkeylen == privkeylen;
+    if (ret && checktype == OSSL_KEYMGMT_VALIDATE_FULL_CHECK)
+        atomic_fetch_or(pin.validated, want);
+
+    end:
+    oqsx_key_unpin(key, &pin);
+    return ret;
+}
+
+/// Key rotation code
+
+void oqsx_key_pin(OQSX_KEY *key, OQSX_KEY_PIN *pin)
+{
+    OQSX_KEY_BODY *body;
+
+    pin->slot = atomic_load(&key->body_epoch) & 1;
+    atomic_fetch_add(&key->body_readers[pin->slot], 1);
+    body = atomic_load(&key->body);
+    if (body != NULL) {
+        pin->privkey = body->privkey;
+        pin->pubkey = body->pubkey;
+        pin->validated = &body->validated;
+    } else {
+        pin->privkey = key->privkey;
+        pin->pubkey = key->pubkey;
+        pin->validated = &key->validated;
+    }
+}
+
+void oqsx_key_unpin(OQSX_KEY *key, const OQSX_KEY_PIN *pin)
+{
+    atomic_fetch_sub(&key->body_readers[pin->slot], 1);
+}
+
+/*
+ * Readers count themselves in the slot of the current epoch before loading
+ * the body. Once the body is swapped, any reader still seeing the old one
+ * is counted in one of the two slots: flipping the epoch steers new readers
+ * to the other slot so each slot drains in turn.
+ */
+static void oqsx_key_wait_readers(OQSX_KEY *key)
+{
+    int i;
+    unsigned int slot;
+
+    for (i = 0; i < 2; i++) {
+        slot = atomic_fetch_add(&key->body_epoch, 1) & 1;
+        while (atomic_load(&key->body_readers[slot]) != 0)
+            sched_yield();
+    }
+}
+
+int oqsx_key_rotate(OQSX_KEY *key, const unsigned char *privkey, size_t privkeylen,
+                    const unsigned char *pubkey, size_t pubkeylen)
+{
+    size_t bodylen = sizeof(OQSX_KEY_BODY) + key->privkeylen + key->pubkeylen;
+    OQSX_KEY_BODY *body, *old;
+    int expected = 0;
+
+    if (privkeylen != key->privkeylen || pubkeylen != key->pubkeylen)
+        return 0;
+    body = oqsx_arena_zalloc(bodylen);
+    if (body == NULL) {
+        ERR_raise(ERR_LIB_PROV, ERR_R_MALLOC_FAILURE);
+        return 0;
+    }
+    body->privkey = (unsigned char *)(body + 1);
+    body->pubkey = body->privkey + privkeylen;
+    atomic_init(&body->validated, 0);
+    body->len = bodylen;
+    memcpy(body->privkey, privkey, privkeylen);
+    memcpy(body->pubkey, pubkey, pubkeylen);
+
+    // one rotation at a time: the grace period below covers a single swap
+    if (!atomic_compare_exchange_strong(&key->rotating, &expected, 1)) {
+        oqsx_arena_clear_free(body, bodylen);
+        return 0;
+    }
+    old = atomic_exchange(&key->body, body);
+    oqsx_key_wait_readers(key);
+
+    if (old != NULL) {
+        oqsx_arena_clear_free(old, old->len);
+    } else {
+        // first rotation: nothing reads the initial material any more
+        oqsx_arena_clear_free(key->privkey, key->privkeylen);
+        OPENSSL_secure_clear_free(key->pubkey, key->pubkeylen);
+        key->privkey = NULL;
+        key->pubkey = NULL;
+    }
+    atomic_store(&key->rotating, 0);
+    return 1;
+}
@@ -0,0 +1,58 @@
+// SPDX-License-Identifier: Apache-2.0 AND MIT
+
+/*
+ * OQS OpenSSL 3 provider
+ *
+ * Per-CPU sharding of provider statistics (see OQSX_COUNTER) and of the
+ * private key arena's free lists. On Linux the shard is picked by the CPU
+ * the caller runs on; recent glibc answers sched_getcpu() from the thread's
+ * registered rseq area without a system call. Elsewhere, or if that fails,
+ * each thread sticks to a shard assigned on its first update.
+ *
+ * A thread may migrate between picking its shard and updating it, so
+ * updates remain (uncontended) atomic adds rather than rseq critical
+ * sections: the point is that cores no longer bounce one cache line.
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE /* sched_getcpu */
+#include <sched.h>
+#endif
+
+#include <openssl/crypto.h>
+#include "oqsx.h"
+
+static _Atomic unsigned int oqsx_shard_next = 0;
+static _Thread_local int oqsx_shard_thread = -1;
+
+int oqsx_shard_index(void)
+{
+#if defined(__linux__)
+    int cpu = sched_getcpu();
+
+    if (cpu >= 0)
+        return cpu % OQSX_NUM_SHARDS;
+#endif
+    if (oqsx_shard_thread < 0)
+        oqsx_shard_thread = atomic_fetch_add_explicit(&oqsx_shard_next, 1,
+                                                      memory_order_relaxed)
+                            % OQSX_NUM_SHARDS;
+    return oqsx_shard_thread;
+}
+
+/* Negative deltas wrap within a shard; the sum over all shards is exact */
+void oqsx_counter_add(OQSX_COUNTER *c, int64_t delta)
+{
+    atomic_fetch_add_explicit(&c->shard[oqsx_shard_index()].v, (uint64_t)delta,
+                              memory_order_relaxed);
+}
+
+uint64_t oqsx_counter_read(OQSX_COUNTER *c)
+{
+    uint64_t sum = 0;
+    int i;
+
+    for (i = 0; i < OQSX_NUM_SHARDS; i++)
+        sum += atomic_load_explicit(&c->shard[i].v, memory_order_relaxed);
+    return sum;
+}
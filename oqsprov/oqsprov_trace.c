@@ -0,0 +1,151 @@
+// SPDX-License-Identifier: Apache-2.0 AND MIT
+
+/*
+ * OQS OpenSSL 3 provider
+ *
+ * Optional capture of the operation mix: if OQSPROV_TRACE names a file,
+ * every key generation, encapsulation, decapsulation, signature and
+ * verification is appended to it as a fixed-size record (see OQSX_TRACE_REC),
+ * whether it succeeded or not.
+ * No key material or message content is recorded.
+ */
+
+#define _POSIX_C_SOURCE 200809L /* clock_gettime */
+
+#include <openssl/crypto.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "oqsx.h"
+
+/*
+ * Trace state: started with the first provider instance and stopped with
+ * the last one (see oqsx_shared_acquire), so no operation runs concurrently
+ * with either. oqsx_trace_file is only read without the lock to decide
+ * whether tracing is on at all.
+ */
+static FILE *_Atomic oqsx_trace_file = NULL;
+static CRYPTO_RWLOCK *oqsx_trace_lock = NULL;
+static uint64_t oqsx_trace_epoch = 0;
+static char *oqsx_trace_names[OQSX_TRACE_MAX_NAMES];
+static size_t oqsx_trace_num_names = 0;
+
+static uint64_t oqsx_trace_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void oqsx_trace_start(void)
+{
+    const char *path = getenv("OQSPROV_TRACE");
+    FILE *f;
+
+    if (path == NULL || *path == '\0')
+        return;
+    if ((oqsx_trace_lock = CRYPTO_THREAD_lock_new()) == NULL)
+        return;
+    if ((f = fopen(path, "wb")) == NULL
+            || fwrite(OQSX_TRACE_MAGIC, 1, sizeof(OQSX_TRACE_MAGIC) - 1, f)
+               != sizeof(OQSX_TRACE_MAGIC) - 1) {
+        if (f != NULL)
+            fclose(f);
+        CRYPTO_THREAD_lock_free(oqsx_trace_lock);
+        oqsx_trace_lock = NULL;
+        return;
+    }
+    oqsx_trace_epoch = oqsx_trace_clock();
+    oqsx_trace_num_names = 0;
+    atomic_store(&oqsx_trace_file, f);
+}
+
+void oqsx_trace_stop(void)
+{
+    FILE *f = atomic_exchange(&oqsx_trace_file, NULL);
+    size_t i;
+
+    if (f == NULL)
+        return;
+    fclose(f);
+    for (i = 0; i < oqsx_trace_num_names; i++)
+        OPENSSL_free(oqsx_trace_names[i]);
+    oqsx_trace_num_names = 0;
+    CRYPTO_THREAD_lock_free(oqsx_trace_lock);
+    oqsx_trace_lock = NULL;
+}
+
+uint64_t oqsx_trace_begin(void)
+{
+    return atomic_load_explicit(&oqsx_trace_file, memory_order_relaxed) != NULL
+           ? oqsx_trace_clock() : 0;
+}
+
+/* Index of the algorithm name, announced by a name record on first use */
+static int oqsx_trace_name(FILE *f, const char *name)
+{
+    OQSX_TRACE_REC rec;
+    size_t i, len;
+
+    for (i = 0; i < oqsx_trace_num_names; i++)
+        if (!strcmp(oqsx_trace_names[i], name))
+            return (int)i;
+    if (oqsx_trace_num_names == OQSX_TRACE_MAX_NAMES)
+        return -1;
+
+    len = strlen(name);
+    if ((oqsx_trace_names[oqsx_trace_num_names] = OPENSSL_strdup(name)) == NULL)
+        return -1;
+    memset(&rec, 0, sizeof(rec));
+    rec.op = OQSX_TRACE_OP_NAME;
+    rec.alg = (uint16_t)oqsx_trace_num_names;
+    rec.in_len = (uint32_t)len;
+    if (fwrite(&rec, sizeof(rec), 1, f) != 1 || fwrite(name, 1, len, f) != len) {
+        OPENSSL_free(oqsx_trace_names[oqsx_trace_num_names]);
+        return -1;
+    }
+    return (int)oqsx_trace_num_names++;
+}
+
+void oqsx_trace_end(uint64_t start, const OQSX_KEY *key, int op,
+                    size_t in_len, size_t out_len, int ok)
+{
+    OQSX_TRACE_REC rec;
+    CRYPTO_THREAD_ID tid = CRYPTO_THREAD_get_current_id();
+    const char *prefix = "";
+    char name[64];
+    uint64_t end;
+    FILE *f;
+    int alg;
+
+    if (start == 0 || key == NULL || key->tls_name == NULL)
+        return;
+    end = oqsx_trace_clock();
+
+    // hybrid keys carry the PQ algorithm name unless created by group name
+    if ((key->keytype == KEY_TYPE_ECP_HYB_KEM || key->keytype == KEY_TYPE_ECX_HYB_KEM)
+            && strncmp(key->tls_name, key->oqsx_provider_ctx.oqsx_evp_ctx->kex_info->hyb_prefix,
+                       strlen(key->oqsx_provider_ctx.oqsx_evp_ctx->kex_info->hyb_prefix)))
+        prefix = key->oqsx_provider_ctx.oqsx_evp_ctx->kex_info->hyb_prefix;
+    snprintf(name, sizeof(name), "%s%s", prefix, key->tls_name);
+
+    memset(&rec, 0, sizeof(rec));
+    rec.time_ns = start - oqsx_trace_epoch;
+    rec.duration_ns = end - start;
+    memcpy(&rec.thread, &tid, sizeof(tid) < sizeof(rec.thread) ? sizeof(tid) : sizeof(rec.thread));
+    rec.in_len = (uint32_t)in_len;
+    rec.out_len = (uint32_t)out_len;
+    rec.op = (uint8_t)op;
+    rec.ok = ok != 0;
+
+    if (oqsx_trace_lock == NULL || !CRYPTO_THREAD_write_lock(oqsx_trace_lock))
+        return;
+    if ((f = atomic_load(&oqsx_trace_file)) != NULL
+            && (alg = oqsx_trace_name(f, name)) >= 0) {
+        rec.alg = (uint16_t)alg;
+        fwrite(&rec, sizeof(rec), 1, f);
+    }
+    CRYPTO_THREAD_unlock(oqsx_trace_lock);
+}
@@ -14,6 +14,7 @@
 # define OQSX_H
 
 # include <stdatomic.h>
+# include <stdint.h>
 # include <openssl/opensslconf.h>
 
 #  include <openssl/core.h>
@@ -42,14 +43,59 @@
     (secbits == 128 ? "x25519_" #oqsname "" : \
                         "x448_" #oqsname "")
 
+#define OQSX_NUM_CACHED_MDS 8
+#define OQSX_MAX_REUSE_SLOTS 16
+
+#define OQSX_NUM_SHARDS 64
+#define OQSX_CACHE_LINE 64
+
+/*
+ * Statistics counter split into per-CPU shards (see oqsprov_shard.c):
+ * updates touch only the shard of the current CPU, reads sum all shards.
+ */
+struct oqsx_counter_st {
+    struct {
+        _Atomic uint64_t v;
+        char pad[OQSX_CACHE_LINE - sizeof(uint64_t)];
+    } shard[OQSX_NUM_SHARDS];
+};
+
+typedef struct oqsx_counter_st OQSX_COUNTER;
+
+/* Shard of the calling CPU (or thread), in [0, OQSX_NUM_SHARDS) */
+int oqsx_shard_index(void);
+void oqsx_counter_add(OQSX_COUNTER *c, int64_t delta);
+uint64_t oqsx_counter_read(OQSX_COUNTER *c);
+
+/*
+ * Private copy of a generated KEM key; oqsx_reuse_get hands out further
+ * copies of its material, never the slot's key itself
+ */
+struct oqsx_reuse_slot_st {
+    struct oqsx_key_st *key;
+    size_t uses;
+    uint64_t born_ms;
+};
+
+typedef struct oqsx_reuse_slot_st OQSX_REUSE_SLOT;
+
 typedef struct prov_oqs_ctx_st {
     const OSSL_CORE_HANDLE *handle;
     OSSL_LIB_CTX *libctx;         /* For all provider modules */
+    EVP_MD *mds[OQSX_NUM_CACHED_MDS]; /* Digests fetched once from libctx */
+    /* Ephemeral KEM key reuse, off unless configured (reuse_lock != NULL) */
+    CRYPTO_RWLOCK *reuse_lock;
+    size_t reuse_max_uses;
+    uint64_t reuse_max_ms;
+    OQSX_REUSE_SLOT reuse[OQSX_MAX_REUSE_SLOTS];
+    OQSX_COUNTER kem_keygens;
+    OQSX_COUNTER kem_reuses;
 //    BIO_METHOD *corebiometh; // for the time being, do without BIO_METHOD
 } PROV_OQS_CTX;
 
 PROV_OQS_CTX *oqsx_newprovctx(OSSL_LIB_CTX *libctx, const OSSL_CORE_HANDLE *handle);
 void oqsx_freeprovctx(PROV_OQS_CTX *ctx);
+EVP_MD *oqsx_fetch_md(PROV_OQS_CTX *ctx, const char *mdname, const char *mdprops);
 # define PROV_OQS_LIBCTX_OF(provctx) (((PROV_OQS_CTX *)provctx)->libctx)
 
 #include "oqs/oqs.h"
@@ -61,23 +107,91 @@ struct oqsx_kex_info_st {
     size_t kex_length_public_key;
     size_t kex_length_private_key;
     size_t kex_length_secret;
+    const char *hyb_prefix;     /* Algorithm name prefix of hybrids with it */
 };
 
 typedef struct oqsx_kex_info_st OQSX_KEX_INFO;
 
+/*
+ * Classical component of a hybrid key. The EVP parameters are created on
+ * first use only (see oqsx_evp_ctx_params), as many keys never get that far.
+ */
 struct oqsx_evp_ctx_st {
-    EVP_PKEY_CTX *kex;
-    EVP_PKEY *kexParam;
+    _Atomic(EVP_PKEY *) kexParam;
+    EVP_PKEY *(*new_kexParam)(const OQSX_KEX_INFO *kex_info);
     const OQSX_KEX_INFO *kex_info;
 };
 
 typedef struct oqsx_evp_ctx_st OQSX_EVP_CTX;
 
+EVP_PKEY *oqsx_evp_ctx_params(const OQSX_EVP_CTX *evp_ctx);
+
 typedef union {
     OQS_SIG *sig;
     OQS_KEM *kem;
 } OQSX_QS_CTX;
 
+/*
+ * Implementation of the PQ primitives of an algorithm, with liboqs' calling
+ * conventions (OQS_STATUS results); liboqs itself is the default backend.
+ * kem_encaps_batch is optional and encapsulates to n concatenated public
+ * keys, returning ciphertexts and shared secrets concatenated likewise.
+ */
+#define OQSX_BACKEND_KEM 0x01   /* implements KEMs */
+#define OQSX_BACKEND_SIG 0x02   /* implements signatures */
+
+struct oqsx_backend_st {
+    const char *name;
+    unsigned int flags;
+    /* NULL: every algorithm of the flagged primitives */
+    int (*supports)(const char *oqs_name, int is_kem);
+    OQS_STATUS (*kem_keypair)(const OQS_KEM *kem, uint8_t *pk, uint8_t *sk);
+    OQS_STATUS (*kem_encaps)(const OQS_KEM *kem, uint8_t *ct, uint8_t *ss, const uint8_t *pk);
+    OQS_STATUS (*kem_decaps)(const OQS_KEM *kem, uint8_t *ss, const uint8_t *ct, const uint8_t *sk);
+    OQS_STATUS (*kem_encaps_batch)(const OQS_KEM *kem, size_t n, uint8_t *ct, uint8_t *ss,
+                                   const uint8_t *pk);
+    OQS_STATUS (*sig_keypair)(const OQS_SIG *sig, uint8_t *pk, uint8_t *sk);
+    OQS_STATUS (*sig_sign)(const OQS_SIG *sig, uint8_t *s, size_t *slen,
+                           const uint8_t *m, size_t mlen, const uint8_t *sk);
+    OQS_STATUS (*sig_verify)(const OQS_SIG *sig, const uint8_t *m, size_t mlen,
+                             const uint8_t *s, size_t slen, const uint8_t *pk);
+};
+
+typedef struct oqsx_backend_st OQSX_BACKEND;
+
+/*
+ * Provider configuration entries: the backend used by default, and a list
+ * of "algorithm:backend" overrides separated by commas. The selection is
+ * process-wide and applies to algorithms not yet in use.
+ */
+#define OQS_PROV_CONF_BACKEND  "backend"
+#define OQS_PROV_CONF_BACKENDS "backends"
+
+int oqsx_backend_configure(const char *backend, const char *overrides);
+const OQSX_BACKEND *oqsx_backend_select(const char *oqs_name, int is_kem);
+
+/*
+ * Immutable per-algorithm state, interned once per process and shared by
+ * all provider instances (reference counted via oqsx_newprovctx).
+ */
+struct oqsx_shared_alg_st {
+    char *oqs_name;
+    int is_kem;
+    OQSX_QS_CTX qs_ctx;
+    const OQSX_BACKEND *backend;
+    unsigned char *aid;          /* DER encoded OID (signatures only) */
+    size_t aid_len;
+};
+
+typedef struct oqsx_shared_alg_st OQSX_SHARED_ALG;
+
+size_t oqsx_keymgmt_count(void);
+int oqsx_shared_acquire(void);
+void oqsx_shared_release(void);
+const OQSX_SHARED_ALG *oqsx_shared_alg(const char *oqs_name, int is_kem);
+int oqsx_shared_sig_aid(const char *oqs_name, const unsigned char **aid, size_t *aid_len);
+const char *oqsx_sig_oid(const char *oqs_name);
+
 struct oqsx_provider_ctx_st {
     OQSX_QS_CTX oqsx_qs_ctx;
     OQSX_EVP_CTX *oqsx_evp_ctx;
@@ -85,17 +199,63 @@ struct oqsx_provider_ctx_st {
 
 typedef struct oqsx_provider_ctx_st OQSX_PROVIDER_CTX;
 
+/*
+ * KEM keys are a sequence of components (classical first for hybrids), each
+ * owning a slice of the concatenated public key, private key, ciphertext and
+ * shared secret. The layout is computed once in oqsx_key_new so operations
+ * need no per-call length queries.
+ */
+#define OQSX_MAX_KEM_COMPONENTS 3
+
+struct oqsx_kem_comp_st {
+    int is_evp;
+    union {
+        const OQS_KEM *kem;
+        const OQSX_EVP_CTX *evp;
+    } ctx;
+    size_t pubkey_off, pubkeylen;
+    size_t privkey_off, privkeylen;
+    size_t ct_off, ctlen;
+    size_t secret_off, secretlen;
+};
+
+typedef struct oqsx_kem_comp_st OQSX_KEM_COMP;
+
+struct oqsx_kem_layout_st {
+    size_t numcomps;
+    OQSX_KEM_COMP comps[OQSX_MAX_KEM_COMPONENTS];
+    /* Totals over all components */
+    size_t pubkeylen;
+    size_t privkeylen;
+    size_t ctlen;
+    size_t secretlen;
+};
+
+typedef struct oqsx_kem_layout_st OQSX_KEM_LAYOUT;
+
 enum oqsx_key_type_en {
     KEY_TYPE_SIG, KEY_TYPE_KEM, KEY_TYPE_ECP_HYB_KEM, KEY_TYPE_ECX_HYB_KEM
 };
 
 typedef enum oqsx_key_type_en OQSX_KEY_TYPE;
 
+/* Key material installed by oqsx_key_rotate, same lengths as the key's */
+struct oqsx_key_body_st {
+    unsigned char *privkey;
+    unsigned char *pubkey;
+    _Atomic int validated;      /* as OQSX_KEY.validated */
+    size_t len;                 /* of the allocation, body included */
+};
+
+typedef struct oqsx_key_body_st OQSX_KEY_BODY;
+
 struct oqsx_key_st {
     OSSL_LIB_CTX *libctx;
     char *propq;
     OQSX_KEY_TYPE keytype;
     OQSX_PROVIDER_CTX oqsx_provider_ctx;
+    const OQSX_BACKEND *backend; /* of the PQ component */
+    OQSX_KEM_LAYOUT kem_layout;  /* KEM keys only */
     size_t numkeys;
     size_t privkeylen;
     size_t pubkeylen;
@@ -104,17 +264,97 @@ struct oqsx_key_st {
     _Atomic int references;
     void **comp_privkey;
     void **comp_pubkey;
+    /* Initial material, released (NULL) once a body is installed */
     void *privkey;
     void *pubkey;
+    /* Rotated material (NULL: privkey/pubkey above) and its reader counts */
+    _Atomic(OQSX_KEY_BODY *) body;
+    _Atomic unsigned int body_epoch;
+    _Atomic int body_readers[2];
+    _Atomic int rotating;
+    /* OQSX_KEY_VALID_* of privkey/pubkey above, see oqsx_key_validate */
+    _Atomic int validated;
 };
 
 typedef struct oqsx_key_st OQSX_KEY;
 
+/*
+ * Lock-free access to the current key material: operations pin it for their
+ * duration, oqsx_key_rotate swaps in new material and waits until no pinned
+ * reader can still see the old one before erasing it.
+ */
+struct oqsx_key_pin_st {
+    const unsigned char *privkey;
+    const unsigned char *pubkey;
+    _Atomic int *validated;     /* validation state of this material */
+    unsigned int slot;
+};
+
+typedef struct oqsx_key_pin_st OQSX_KEY_PIN;
+
+void oqsx_key_pin(OQSX_KEY *key, OQSX_KEY_PIN *pin);
+void oqsx_key_unpin(OQSX_KEY *key, const OQSX_KEY_PIN *pin);
+int oqsx_key_rotate(OQSX_KEY *key, const unsigned char *privkey, size_t privkeylen,
+                    const unsigned char *pubkey, size_t pubkeylen);
+
+/*
+ * Key parameters (octet strings, set together via EVP_PKEY_set_params)
+ * replacing the keypair of a live key for all operations started afterwards.
+ */
+#define OQS_PARAM_ROTATE_PRIV_KEY "oqs-rotate-priv"
+#define OQS_PARAM_ROTATE_PUB_KEY  "oqs-rotate-pub"
+
 OQSX_KEY *oqsx_key_new(OSSL_LIB_CTX *libctx, char* oqs_name, char* tls_name, int is_kem, const char *propq);
 int oqsx_key_allocate_keymaterial(OQSX_KEY *key);
 void oqsx_key_free(OQSX_KEY *key);
 int oqsx_key_up_ref(OQSX_KEY *key);
 int oqsx_key_gen(OQSX_KEY *key);
+int oqsx_key_gen_shared(OQSX_KEY *key, EVP_PKEY *classical);
+/*
+ * Opt-in reuse of generated KEM keys: with both provider configuration
+ * entries set (and uses > 1), key generation hands out the same key of an
+ * algorithm for up to reuse_uses generations and reuse_ms milliseconds, then
+ * generates a fresh one. Each key handed out is an independent object with a
+ * copy of the keypair; only keypair generation (not paramgen) reuses keys.
+ */
+#define OQS_PROV_CONF_REUSE_USES "ephemeral_reuse_uses"
+#define OQS_PROV_CONF_REUSE_MS   "ephemeral_reuse_ms"
+/* Provider parameters (uint64): KEM keys generated, and handed out again */
+#define OQS_PROV_PARAM_KEM_KEYGENS "oqs-kem-keygens"
+#define OQS_PROV_PARAM_KEM_REUSES  "oqs-kem-reuses"
+
+int oqsx_reuse_configure(PROV_OQS_CTX *ctx, size_t max_uses, uint64_t max_ms);
+OQSX_KEY *oqsx_reuse_get(PROV_OQS_CTX *ctx, int primitive, const char *tls_name);
+void oqsx_reuse_put(PROV_OQS_CTX *ctx, OQSX_KEY *key);
+
+/* Number of OQSX_KEY objects currently allocated, across all providers */
+size_t oqsx_key_live_count(void);
+
+/*
+ * Provider parameter (size_t, via OSSL_PROVIDER_get_params) reporting
+ * oqsx_key_live_count(), e.g. for leak checks of long-running processes.
+ */
+#define OQS_PROV_PARAM_LIVE_KEYS "oqs-live-keys"
+
+/*
+ * Optional arena for private keys (see oqsprov_arena.c), reserved at load
+ * time if the provider configuration entry sets its size in bytes. The
+ * provider parameters (size_t) report its size and the bytes in use.
+ */
+#define OQS_PROV_CONF_ARENA_SIZE  "secure_arena_size"
+#define OQS_PROV_PARAM_ARENA_SIZE "oqs-arena-size"
+#define OQS_PROV_PARAM_ARENA_USED "oqs-arena-used"
+
+int oqsx_arena_configure(size_t size);
+void *oqsx_arena_zalloc(size_t len);
+void oqsx_arena_clear_free(void *ptr, size_t len);
+void oqsx_arena_stats(size_t *size, size_t *used);
+
+/*
+ * Key generation parameter (octet pointer to an EVP_PKEY) naming a sibling
+ * key whose classical keypair a hybrid key reuses instead of generating one.
+ */
+#define OQS_PARAM_CLASSICAL_SIBLING "oqs-classical-sibling"
 
 /* Backend support */
 int oqsx_public_from_private(OQSX_KEY *key);
@@ -122,4 +362,109 @@ int oqsx_key_fromdata(OQSX_KEY *oqsxk, const OSSL_PARAM params[],
                      int include_private);
 int oqsx_key_parambits(OQSX_KEY *k);
 int oqsx_key_maxsize(OQSX_KEY *k);
+
+/*
+ * Checks the key components selected by OSSL_KEYMGMT_SELECT_*: lengths
+ * always, and with OSSL_KEYMGMT_VALIDATE_FULL_CHECK the contents (classical
+ * EC points, Kyber coefficient ranges). Full results are cached with the
+ * key material (key or rotated body), so repeated validations are O(1).
+ */
+#define OQSX_KEY_VALID_PUBLIC  0x01
+#define OQSX_KEY_VALID_PRIVATE 0x02
+
+int oqsx_key_validate(OQSX_KEY *key, int selection, int checktype);
+/* Replaces the cached state of the key material operations currently use */
+void oqsx_key_set_validated(OQSX_KEY *key, int validated);
+
+/*
+ * Operation trace, written to the file named by OQSPROV_TRACE: the magic
+ * followed by fixed-size records in host byte order. A name record
+ * (op OQSX_TRACE_OP_NAME, in_len bytes of name following it) announces
+ * each algorithm index before its first use. Failed operations are
+ * recorded too, with ok = 0.
+ */
+#define OQSX_TRACE_MAGIC     "OQSTRC2\n"
+#define OQSX_TRACE_MAX_NAMES 256
+
+enum oqsx_trace_op_en {
+    OQSX_TRACE_OP_NAME, OQSX_TRACE_OP_KEYGEN, OQSX_TRACE_OP_ENCAPS,
+    OQSX_TRACE_OP_DECAPS, OQSX_TRACE_OP_SIGN, OQSX_TRACE_OP_VERIFY
+};
+
+struct oqsx_trace_rec_st {
+    uint64_t time_ns;      /* start, relative to the start of the trace */
+    uint64_t thread;       /* opaque id of the calling thread */
+    uint64_t duration_ns;
+    uint32_t in_len;       /* ciphertext/message length, name length */
+    uint32_t out_len;      /* ciphertext/signature length */
+    uint16_t alg;
+    uint8_t op;
+    uint8_t ok;            /* 1 if the operation succeeded */
+};
+
+typedef struct oqsx_trace_rec_st OQSX_TRACE_REC;
+
+void oqsx_trace_start(void);
+void oqsx_trace_stop(void);
+/* Returns 0 if tracing is off, which oqsx_trace_end then ignores */
+uint64_t oqsx_trace_begin(void);
+void oqsx_trace_end(uint64_t start, const OQSX_KEY *key, int op,
+                    size_t in_len, size_t out_len, int ok);
+
+/*
+ * Caller-supplied scratch memory for KEM contexts: set as OSSL_PARAM octet
+ * pointer OQS_PARAM_SCRATCH, required size is reported via
+ * OQS_PARAM_SCRATCH_SIZE. It holds the raw shared secrets of operations
+ * deriving their output (OQS_PARAM_KEM_KDF_DIGEST); requests that do not
+ * fit fall back to the secure heap.
+ */
+#define OQS_PARAM_SCRATCH      "oqs-scratch"
+#define OQS_PARAM_SCRATCH_SIZE "oqs-scratch-size"
+
+/*
+ * KEM context parameter (octet string): concatenated public keys of the
+ * context key's algorithm; encapsulation then runs once per recipient and
+ * returns ciphertexts and shared secrets concatenated in that order.
+ */
+#define OQS_PARAM_KEM_RECIPIENTS "oqs-recipients"
+
+/*
+ * KEM context parameters deriving the secret returned by encapsulation and
+ * decapsulation with HKDF (digest name, salt, info, output length) instead
+ * of returning the raw shared secret; an empty digest name turns this off.
+ */
+#define OQS_PARAM_KEM_KDF_DIGEST "oqs-kdf-digest"
+#define OQS_PARAM_KEM_KDF_SALT   "oqs-kdf-salt"
+#define OQS_PARAM_KEM_KDF_INFO   "oqs-kdf-info"
+#define OQS_PARAM_KEM_KDF_LEN    "oqs-kdf-len"
+
+/*
+ * KEM and signature context parameter (uint64): absolute deadline in
+ * milliseconds since the epoch, 0 for none. Operations still to start once
+ * it has passed fail with OQSPROV_R_DEADLINE_EXCEEDED (ERR_LIB_PROV; above
+ * OpenSSL's own PROV_R_* reasons). liboqs runs an algorithm to completion,
+ * so this is checked before each component of a hybrid key and before each
+ * recipient.
+ */
+#define OQS_PARAM_DEADLINE "oqs-deadline"
+#define OQSPROV_R_DEADLINE_EXCEEDED 1000
+
+int oqsx_deadline_passed(uint64_t deadline);
+
+struct oqsx_scratch_st {
+    unsigned char *buf;
+    size_t size;
+    size_t used;
+};
+
+typedef struct oqsx_scratch_st OQSX_SCRATCH;
+
+// keep carved blocks aligned for any temporary placed there
+#define OQSX_SCRATCH_ALIGN 16
+#define OQSX_SCRATCH_ROUND(len) \
+    (((len) + OQSX_SCRATCH_ALIGN - 1) & ~(size_t)(OQSX_SCRATCH_ALIGN - 1))
+
+int oqsx_scratch_set(OQSX_SCRATCH *scratch, const OSSL_PARAM *p);
+void *oqsx_scratch_alloc(OQSX_SCRATCH *scratch, size_t len);
+void oqsx_scratch_free(OQSX_SCRATCH *scratch, void *ptr, size_t len);
 #endif
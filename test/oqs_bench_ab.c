@@ -0,0 +1,325 @@
+// SPDX-License-Identifier: Apache-2.0 AND MIT
+
+/*
+ * Side-by-side comparison of two builds of the provider.
+ *
+ * Loads the oqsprovider module found in each of two directories into its
+ * own library context and runs the same operations on both, alternating
+ * in random order within each round so that host noise hits both alike.
+ * Per algorithm and operation, reports the mean latencies, the relative
+ * difference of B against A with a 95% confidence interval over the
+ * paired rounds, and whether B is significantly faster or slower.
+ * Not run by ctest:
+ *
+ *    oqs_bench_ab <module-dir-A> <module-dir-B> [rounds] [batch]
+ */
+
+#define _POSIX_C_SOURCE 200809L /* clock_gettime */
+
+#include <openssl/evp.h>
+#include <openssl/provider.h>
+#include <openssl/rand.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "test_common.h"
+
+#define SIDES 2
+
+struct side {
+  const char *dir;
+  OSSL_LIB_CTX *libctx;
+  OSSL_PROVIDER *deflt;
+  OSSL_PROVIDER *oqs;
+};
+
+static struct side sides[SIDES];
+static size_t rounds = 30;
+static size_t batch = 20;
+
+#define nelem(a) (sizeof(a)/sizeof((a)[0]))
+
+enum { OP_KEYGEN, OP_ENCAPS, OP_DECAPS, OP_SIGN, OP_VERIFY };
+
+static const char *op_names[] = { "keygen", "encaps", "decaps", "sign", "verify" };
+
+/* State for running one operation of one algorithm on one side */
+struct job {
+  const char *alg;
+  int op;
+  OSSL_LIB_CTX *libctx;
+  EVP_PKEY *key;
+  EVP_PKEY_CTX *ctx;
+  unsigned char *ct, *secret, *sig;
+  size_t ctlen, secretlen, siglen;
+};
+
+static const unsigned char msg[] = "The quick brown fox jumps over... you know what";
+
+static double now_us(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* Two-sided 95% quantiles of Student's t for 1..30 degrees of freedom */
+static double t95(size_t df)
+{
+  static const double t[] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+  };
+
+  return df == 0 ? INFINITY : df <= nelem(t) ? t[df - 1] : 1.960;
+}
+
+static EVP_PKEY *keygen(OSSL_LIB_CTX *libctx, const char *alg)
+{
+  EVP_PKEY_CTX *ctx = NULL;
+  EVP_PKEY *key = NULL;
+
+  if ((ctx = EVP_PKEY_CTX_new_from_name(libctx, alg, NULL)) == NULL
+      || EVP_PKEY_keygen_init(ctx) <= 0
+      || EVP_PKEY_generate(ctx, &key) <= 0)
+    key = NULL;
+  EVP_PKEY_CTX_free(ctx);
+  return key;
+}
+
+static void job_cleanup(struct job *job)
+{
+  OPENSSL_free(job->sig);
+  OPENSSL_clear_free(job->secret, job->secretlen);
+  OPENSSL_free(job->ct);
+  EVP_PKEY_CTX_free(job->ctx);
+  EVP_PKEY_free(job->key);
+  memset(job, 0, sizeof(*job));
+}
+
+/* Prepares key, context and buffers so that job_run only times the op */
+static int job_setup(struct job *job, OSSL_LIB_CTX *libctx, const char *alg, int op)
+{
+  memset(job, 0, sizeof(*job));
+  job->alg = alg;
+  job->op = op;
+  job->libctx = libctx;
+  if (op == OP_KEYGEN)
+    return 1;
+
+  if ((job->key = keygen(libctx, alg)) == NULL
+      || (job->ctx = EVP_PKEY_CTX_new_from_pkey(libctx, job->key, NULL)) == NULL)
+    goto err;
+  switch (op) {
+  case OP_ENCAPS:
+  case OP_DECAPS:
+    if (EVP_PKEY_encapsulate_init(job->ctx, NULL) <= 0
+        || EVP_PKEY_encapsulate(job->ctx, NULL, &job->ctlen, NULL, &job->secretlen) <= 0
+        || (job->ct = OPENSSL_malloc(job->ctlen)) == NULL
+        || (job->secret = OPENSSL_malloc(job->secretlen)) == NULL
+        || EVP_PKEY_encapsulate(job->ctx, job->ct, &job->ctlen, job->secret, &job->secretlen) <= 0
+        || (op == OP_DECAPS && EVP_PKEY_decapsulate_init(job->ctx, NULL) <= 0))
+      goto err;
+    break;
+  case OP_SIGN:
+  case OP_VERIFY:
+    if (EVP_PKEY_sign_init(job->ctx) <= 0
+        || EVP_PKEY_sign(job->ctx, NULL, &job->siglen, msg, sizeof(msg)) <= 0
+        || (job->sig = OPENSSL_malloc(job->siglen)) == NULL
+        || EVP_PKEY_sign(job->ctx, job->sig, &job->siglen, msg, sizeof(msg)) <= 0
+        || (op == OP_VERIFY && EVP_PKEY_verify_init(job->ctx) <= 0))
+      goto err;
+    break;
+  }
+  return 1;
+
+  err:
+  job_cleanup(job);
+  return 0;
+}
+
+/* Runs the operation batch times; returns the mean latency, < 0 on errors */
+static double job_run(struct job *job)
+{
+  EVP_PKEY *key;
+  size_t i, len;
+  double t = now_us();
+  int ok = 1;
+
+  for (i = 0; i < batch && ok; i++) {
+    switch (job->op) {
+    case OP_KEYGEN:
+      ok = (key = keygen(job->libctx, job->alg)) != NULL;
+      EVP_PKEY_free(key);
+      break;
+    case OP_ENCAPS:
+      ok = EVP_PKEY_encapsulate(job->ctx, job->ct, &job->ctlen, job->secret, &job->secretlen) > 0;
+      break;
+    case OP_DECAPS:
+      len = job->secretlen;
+      ok = EVP_PKEY_decapsulate(job->ctx, job->secret, &len, job->ct, job->ctlen) > 0;
+      break;
+    case OP_SIGN:
+      len = job->siglen;
+      ok = EVP_PKEY_sign(job->ctx, job->sig, &len, msg, sizeof(msg)) > 0;
+      break;
+    case OP_VERIFY:
+      ok = EVP_PKEY_verify(job->ctx, job->sig, job->siglen, msg, sizeof(msg)) > 0;
+      break;
+    }
+  }
+  return ok ? (now_us() - t) / batch : -1;
+}
+
+static int compare(const char *alg, int op)
+{
+  struct job jobs[SIDES];
+  double *lat[SIDES] = { NULL, NULL }, mean[SIDES] = { 0, 0 };
+  double d, dmean = 0, dvar = 0, ci;
+  unsigned char coin;
+  size_t r;
+  int s, first, ret = 0;
+
+  memset(jobs, 0, sizeof(jobs));
+  for (s = 0; s < SIDES; s++)
+    if (!job_setup(&jobs[s], sides[s].libctx, alg, op)
+        || (lat[s] = OPENSSL_malloc(rounds * sizeof(double))) == NULL)
+      goto err;
+
+  for (r = 0; r < rounds; r++) {
+    if (RAND_bytes(&coin, 1) <= 0)
+      goto err;
+    first = coin & 1;
+    for (s = 0; s < SIDES; s++) {
+      int side = s ^ first;
+
+      if ((lat[side][r] = job_run(&jobs[side])) < 0)
+        goto err;
+    }
+  }
+
+  /* relative difference of B against A, paired per round */
+  for (r = 0; r < rounds; r++) {
+    for (s = 0; s < SIDES; s++)
+      mean[s] += lat[s][r] / rounds;
+    dmean += (lat[1][r] / lat[0][r] - 1) / rounds;
+  }
+  for (r = 0; r < rounds; r++) {
+    d = lat[1][r] / lat[0][r] - 1 - dmean;
+    dvar += d * d / (rounds > 1 ? rounds - 1 : 1);
+  }
+  ci = t95(rounds - 1) * sqrt(dvar / rounds);
+  printf("%-28s %-7s %10.1f %10.1f %+8.2f%% %7.2f%%  %s\n", alg, op_names[op],
+         mean[0], mean[1], 100 * dmean, 100 * ci,
+         dmean + ci < 0 ? "B faster" : dmean - ci > 0 ? "B slower" : "-");
+  ret = 1;
+
+  err:
+  for (s = 0; s < SIDES; s++) {
+    OPENSSL_free(lat[s]);
+    job_cleanup(&jobs[s]);
+  }
+  return ret;
+}
+
+/* Collects the algorithm names implemented by the provider under test */
+struct names {
+  char *list[256];
+  size_t count;
+  OSSL_PROVIDER *prov;
+};
+
+static void collect_kem(EVP_KEM *kem, void *arg)
+{
+  struct names *names = arg;
+
+  if (names->count < nelem(names->list) && EVP_KEM_get0_provider(kem) == names->prov)
+    names->list[names->count++] = OPENSSL_strdup(EVP_KEM_get0_name(kem));
+}
+
+static void collect_sig(EVP_SIGNATURE *sig, void *arg)
+{
+  struct names *names = arg;
+
+  if (names->count < nelem(names->list) && EVP_SIGNATURE_get0_provider(sig) == names->prov)
+    names->list[names->count++] = OPENSSL_strdup(EVP_SIGNATURE_get0_name(sig));
+}
+
+/* Whether side B offers the algorithm too; only common ones are compared */
+static int available_in_b(const char *alg)
+{
+  EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new_from_name(sides[1].libctx, alg, NULL);
+
+  EVP_PKEY_CTX_free(ctx);
+  ERR_clear_error();
+  return ctx != NULL;
+}
+
+int main(int argc, char *argv[])
+{
+  struct names kems = { { NULL }, 0, NULL }, sigs = { { NULL }, 0, NULL };
+  static const int kem_ops[] = { OP_KEYGEN, OP_ENCAPS, OP_DECAPS };
+  static const int sig_ops[] = { OP_SIGN, OP_VERIFY };
+  size_t i, j;
+  int s, errcnt = 0, test = 0;
+
+  T(argc >= 3 && argc <= 5);
+  sides[0].dir = argv[1];
+  sides[1].dir = argv[2];
+  if (argc >= 4)
+    T((rounds = strtoul(argv[3], NULL, 10)) > 1);
+  if (argc == 5)
+    T((batch = strtoul(argv[4], NULL, 10)) > 0);
+
+  for (s = 0; s < SIDES; s++) {
+    T((sides[s].libctx = OSSL_LIB_CTX_new()) != NULL);
+    T((sides[s].deflt = OSSL_PROVIDER_load(sides[s].libctx, "default")) != NULL);
+    T(OSSL_PROVIDER_set_default_search_path(sides[s].libctx, sides[s].dir));
+    T((sides[s].oqs = OSSL_PROVIDER_load(sides[s].libctx, PROVIDER_NAME_OQS)) != NULL);
+  }
+
+  kems.prov = sigs.prov = sides[0].oqs;
+  EVP_KEM_do_all_provided(sides[0].libctx, collect_kem, &kems);
+  EVP_SIGNATURE_do_all_provided(sides[0].libctx, collect_sig, &sigs);
+
+  printf("A: %s\nB: %s\n%zu rounds of %zu operations per side\n\n",
+         sides[0].dir, sides[1].dir, rounds, batch);
+  printf("%-28s %-7s %10s %10s %9s %8s\n", "algorithm", "op", "A_us", "B_us",
+         "delta", "ci95");
+  for (i = 0; i < kems.count; i++) {
+    if (kems.list[i] == NULL || !available_in_b(kems.list[i]))
+      continue;
+    for (j = 0; j < nelem(kem_ops); j++)
+      if (!compare(kems.list[i], kem_ops[j])) {
+        fprintf(stderr, cRED "  Comparison failed: %s %s" cNORM "\n", kems.list[i], op_names[kem_ops[j]]);
+        ERR_print_errors_fp(stderr);
+        errcnt++;
+      }
+  }
+  for (i = 0; i < sigs.count; i++) {
+    if (sigs.list[i] == NULL || !available_in_b(sigs.list[i]))
+      continue;
+    for (j = 0; j < nelem(sig_ops); j++)
+      if (!compare(sigs.list[i], sig_ops[j])) {
+        fprintf(stderr, cRED "  Comparison failed: %s %s" cNORM "\n", sigs.list[i], op_names[sig_ops[j]]);
+        ERR_print_errors_fp(stderr);
+        errcnt++;
+      }
+  }
+
+  for (i = 0; i < kems.count; i++)
+    OPENSSL_free(kems.list[i]);
+  for (i = 0; i < sigs.count; i++)
+    OPENSSL_free(sigs.list[i]);
+  for (s = 0; s < SIDES; s++) {
+    OSSL_PROVIDER_unload(sides[s].oqs);
+    OSSL_PROVIDER_unload(sides[s].deflt);
+    OSSL_LIB_CTX_free(sides[s].libctx);
+  }
+
+  TEST_ASSERT(errcnt == 0)
+  return !test;
+}
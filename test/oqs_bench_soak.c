@@ -0,0 +1,334 @@
+// SPDX-License-Identifier: Apache-2.0 AND MIT
+
+/*
+ * Soak benchmark: memory growth over many mixed operations.
+ *
+ * Each iteration runs one KEM "handshake" (fresh client key, server import
+ * of the client public key, encapsulation, decapsulation) and one signature
+ * "handshake" (sign with a long-lived server key, verify with a freshly
+ * imported copy of its public key), cycling through all algorithms of the
+ * provider so that key buffers of all sizes are allocated and freed.
+ *
+ * RSS, secure heap use, live provider key objects and free heap memory are
+ * sampled periodically. Fails if, between the first sample (taken after every
+ * algorithm has been used once) and the last one, RSS or secure heap use grow
+ * by more than the given percentage or the number of live keys grows at all.
+ * Not run by ctest:
+ *
+ *    oqs_bench_soak <provider> <config> [iterations] [max-growth-percent]
+ */
+
+#define _POSIX_C_SOURCE 200809L /* clock_gettime */
+
+#include <openssl/core_names.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/provider.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __GLIBC__
+# include <malloc.h>
+#endif
+#include "test_common.h"
+
+/* Must match OQS_PROV_PARAM_LIVE_KEYS in oqsprov/oqsx.h */
+#define OQS_PROV_PARAM_LIVE_KEYS "oqs-live-keys"
+
+#define SECURE_HEAP_SIZE (4 * 1024 * 1024)
+#define SECURE_HEAP_MINSIZE 32
+#define SAMPLES 100
+
+static OSSL_LIB_CTX *libctx = NULL;
+static OSSL_PROVIDER *prov = NULL;
+static char *modulename = NULL;
+static char *configfile = NULL;
+static size_t iterations = 1000000;
+static double max_growth = 5.0;
+
+#define nelem(a) (sizeof(a)/sizeof((a)[0]))
+
+struct sample {
+  size_t iteration;
+  double seconds;
+  size_t rss;           /* bytes */
+  size_t secure_used;   /* bytes */
+  size_t live_keys;
+  double heap_free;     /* percent of the heap that is free, -1 if unknown */
+};
+
+static double now_s(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t rss_bytes(void)
+{
+  FILE *f = fopen("/proc/self/statm", "r");
+  unsigned long size, resident = 0;
+
+  if (f == NULL)
+    return 0;
+  if (fscanf(f, "%lu %lu", &size, &resident) != 2)
+    resident = 0;
+  fclose(f);
+  return resident * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+/* Free memory within the malloc heap, as share of what malloc holds */
+static double heap_free_percent(void)
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+  struct mallinfo2 mi = mallinfo2();
+
+  return mi.arena == 0 ? 0 : 100.0 * mi.fordblks / mi.arena;
+#else
+  return -1;
+#endif
+}
+
+static void take_sample(struct sample *s, size_t iteration, double start)
+{
+  OSSL_PARAM params[2];
+
+  s->iteration = iteration;
+  s->seconds = now_s() - start;
+  s->rss = rss_bytes();
+  s->secure_used = CRYPTO_secure_used();
+  s->live_keys = 0;
+  params[0] = OSSL_PARAM_construct_size_t(OQS_PROV_PARAM_LIVE_KEYS, &s->live_keys);
+  params[1] = OSSL_PARAM_construct_end();
+  OSSL_PROVIDER_get_params(prov, params);
+  s->heap_free = heap_free_percent();
+
+  printf("%12zu %10.1f %12zu %12zu %10zu %9.1f\n", s->iteration, s->seconds,
+         s->rss / 1024, s->secure_used, s->live_keys, s->heap_free);
+  fflush(stdout);
+}
+
+static double growth(size_t from, size_t to)
+{
+  if (to <= from)
+    return 0;
+  return from == 0 ? 100.0 : 100.0 * (to - from) / from;
+}
+
+static EVP_PKEY *keygen(const char *alg)
+{
+  EVP_PKEY_CTX *ctx = NULL;
+  EVP_PKEY *key = NULL;
+
+  if ((ctx = EVP_PKEY_CTX_new_from_name(libctx, alg, NULL)) == NULL
+      || EVP_PKEY_keygen_init(ctx) <= 0
+      || EVP_PKEY_generate(ctx, &key) <= 0)
+    key = NULL;
+  EVP_PKEY_CTX_free(ctx);
+  return key;
+}
+
+/* Imports the public key of key into a new key object, as a peer would */
+static EVP_PKEY *import_public(const char *alg, const EVP_PKEY *key)
+{
+  EVP_PKEY_CTX *ctx = NULL;
+  EVP_PKEY *peer = NULL;
+  OSSL_PARAM params[2];
+  unsigned char *pub = NULL;
+  size_t publen = 0;
+
+  if (!EVP_PKEY_get_octet_string_param(key, OSSL_PKEY_PARAM_PUB_KEY, NULL, 0, &publen)
+      || (pub = OPENSSL_malloc(publen)) == NULL
+      || !EVP_PKEY_get_octet_string_param(key, OSSL_PKEY_PARAM_PUB_KEY, pub, publen, &publen))
+    goto err;
+  params[0] = OSSL_PARAM_construct_octet_string(OSSL_PKEY_PARAM_PUB_KEY, pub, publen);
+  params[1] = OSSL_PARAM_construct_end();
+  if ((ctx = EVP_PKEY_CTX_new_from_name(libctx, alg, NULL)) == NULL
+      || EVP_PKEY_fromdata_init(ctx) <= 0
+      || EVP_PKEY_fromdata(ctx, &peer, EVP_PKEY_PUBLIC_KEY, params) <= 0)
+    peer = NULL;
+
+  err:
+  EVP_PKEY_CTX_free(ctx);
+  OPENSSL_free(pub);
+  return peer;
+}
+
+static int kem_handshake(const char *alg)
+{
+  EVP_PKEY *client = NULL, *peer = NULL;
+  EVP_PKEY_CTX *sctx = NULL, *cctx = NULL;
+  unsigned char *ct = NULL, *ssecret = NULL, *csecret = NULL;
+  size_t ctlen = 0, ssecretlen = 0, csecretlen = 0;
+  int ret = 0;
+
+  if ((client = keygen(alg)) == NULL
+      || (peer = import_public(alg, client)) == NULL
+      || (sctx = EVP_PKEY_CTX_new_from_pkey(libctx, peer, NULL)) == NULL
+      || EVP_PKEY_encapsulate_init(sctx, NULL) <= 0
+      || EVP_PKEY_encapsulate(sctx, NULL, &ctlen, NULL, &ssecretlen) <= 0
+      || (ct = OPENSSL_malloc(ctlen)) == NULL
+      || (ssecret = OPENSSL_malloc(ssecretlen)) == NULL
+      || EVP_PKEY_encapsulate(sctx, ct, &ctlen, ssecret, &ssecretlen) <= 0
+      || (cctx = EVP_PKEY_CTX_new_from_pkey(libctx, client, NULL)) == NULL
+      || EVP_PKEY_decapsulate_init(cctx, NULL) <= 0
+      || EVP_PKEY_decapsulate(cctx, NULL, &csecretlen, ct, ctlen) <= 0
+      || (csecret = OPENSSL_malloc(csecretlen)) == NULL
+      || EVP_PKEY_decapsulate(cctx, csecret, &csecretlen, ct, ctlen) <= 0)
+    goto err;
+  ret = csecretlen == ssecretlen && !memcmp(csecret, ssecret, ssecretlen);
+
+  err:
+  OPENSSL_clear_free(csecret, csecretlen);
+  OPENSSL_clear_free(ssecret, ssecretlen);
+  OPENSSL_free(ct);
+  EVP_PKEY_CTX_free(cctx);
+  EVP_PKEY_CTX_free(sctx);
+  EVP_PKEY_free(peer);
+  EVP_PKEY_free(client);
+  return ret;
+}
+
+static int sig_handshake(const char *alg, EVP_PKEY *server, size_t i)
+{
+  EVP_PKEY *peer = NULL;
+  EVP_PKEY_CTX *sctx = NULL, *cctx = NULL;
+  unsigned char msg[64], *sig = NULL;
+  size_t siglen = 0;
+  int ret = 0;
+
+  /* transcript hash stand-in, different every time */
+  memset(msg, 0, sizeof(msg));
+  memcpy(msg, &i, sizeof(i));
+
+  if ((peer = import_public(alg, server)) == NULL
+      || (sctx = EVP_PKEY_CTX_new_from_pkey(libctx, server, NULL)) == NULL
+      || EVP_PKEY_sign_init(sctx) <= 0
+      || EVP_PKEY_sign(sctx, NULL, &siglen, msg, sizeof(msg)) <= 0
+      || (sig = OPENSSL_malloc(siglen)) == NULL
+      || EVP_PKEY_sign(sctx, sig, &siglen, msg, sizeof(msg)) <= 0
+      || (cctx = EVP_PKEY_CTX_new_from_pkey(libctx, peer, NULL)) == NULL
+      || EVP_PKEY_verify_init(cctx) <= 0
+      || EVP_PKEY_verify(cctx, sig, siglen, msg, sizeof(msg)) <= 0)
+    goto err;
+  ret = 1;
+
+  err:
+  OPENSSL_free(sig);
+  EVP_PKEY_CTX_free(cctx);
+  EVP_PKEY_CTX_free(sctx);
+  EVP_PKEY_free(peer);
+  return ret;
+}
+
+/* Collects the algorithm names implemented by the provider under test */
+struct names {
+  char *list[256];
+  size_t count;
+};
+
+static void collect_kem(EVP_KEM *kem, void *arg)
+{
+  struct names *names = arg;
+
+  if (names->count < nelem(names->list)
+      && !strcmp(OSSL_PROVIDER_get0_name(EVP_KEM_get0_provider(kem)), modulename))
+    names->list[names->count++] = OPENSSL_strdup(EVP_KEM_get0_name(kem));
+}
+
+static void collect_sig(EVP_SIGNATURE *sig, void *arg)
+{
+  struct names *names = arg;
+
+  if (names->count < nelem(names->list)
+      && !strcmp(OSSL_PROVIDER_get0_name(EVP_SIGNATURE_get0_provider(sig)), modulename))
+    names->list[names->count++] = OPENSSL_strdup(EVP_SIGNATURE_get0_name(sig));
+}
+
+int main(int argc, char *argv[])
+{
+  struct names kems = { { NULL }, 0 }, sigs = { { NULL }, 0 };
+  EVP_PKEY *server[nelem(sigs.list)] = { NULL };
+  struct sample first = { 0 }, last = { 0 };
+  size_t i, interval, fails = 0;
+  double start;
+  int errcnt = 0, test = 0;
+
+  /* private keys of this provider live in the secure heap */
+  T(CRYPTO_secure_malloc_init(SECURE_HEAP_SIZE, SECURE_HEAP_MINSIZE));
+  T((libctx = OSSL_LIB_CTX_new()) != NULL);
+  T(argc >= 3 && argc <= 5);
+  modulename = argv[1];
+  configfile = argv[2];
+  if (argc >= 4)
+    T((iterations = strtoul(argv[3], NULL, 10)) > 0);
+  if (argc == 5)
+    T((max_growth = strtod(argv[4], NULL)) >= 0);
+
+  T(OSSL_LIB_CTX_load_config(libctx, configfile));
+  T(OSSL_PROVIDER_available(libctx, modulename));
+  T((prov = OSSL_PROVIDER_load(libctx, modulename)) != NULL);
+
+  EVP_KEM_do_all_provided(libctx, collect_kem, &kems);
+  EVP_SIGNATURE_do_all_provided(libctx, collect_sig, &sigs);
+  T(kems.count > 0 || sigs.count > 0);
+
+  for (i = 0; i < sigs.count; i++)
+    if (sigs.list[i] == NULL || (server[i] = keygen(sigs.list[i])) == NULL) {
+      fprintf(stderr, cRED "  Server key generation failed: %s" cNORM "\n", sigs.list[i]);
+      ERR_print_errors_fp(stderr);
+      errcnt++;
+    }
+
+  /* the first sample is taken once every algorithm has been used */
+  interval = iterations / SAMPLES;
+  if (interval < kems.count || interval < sigs.count)
+    interval = kems.count > sigs.count ? kems.count : sigs.count;
+
+  printf("%12s %10s %12s %12s %10s %9s\n", "iteration", "seconds",
+         "rss_kib", "secure_used", "live_keys", "heap_free");
+  start = now_s();
+  for (i = 0; i < iterations && errcnt == 0; i++) {
+    if (kems.count > 0 && !kem_handshake(kems.list[i % kems.count])) {
+      fprintf(stderr, cRED "  KEM handshake failed: %s" cNORM "\n", kems.list[i % kems.count]);
+      fails++;
+    }
+    if (sigs.count > 0 && !sig_handshake(sigs.list[i % sigs.count], server[i % sigs.count], i)) {
+      fprintf(stderr, cRED "  Signature handshake failed: %s" cNORM "\n", sigs.list[i % sigs.count]);
+      fails++;
+    }
+    if (fails > 0) {
+      ERR_print_errors_fp(stderr);
+      errcnt++;
+    }
+    if ((i + 1) % interval == 0)
+      take_sample(i + 1 == interval ? &first : &last, i + 1, start);
+  }
+
+  if (errcnt == 0 && iterations >= 2 * interval) {
+    printf("growth: rss %.1f%%, secure heap %.1f%%, live keys %zu -> %zu\n",
+           growth(first.rss, last.rss), growth(first.secure_used, last.secure_used),
+           first.live_keys, last.live_keys);
+    if (growth(first.rss, last.rss) > max_growth
+        || growth(first.secure_used, last.secure_used) > max_growth
+        || last.live_keys > first.live_keys) {
+      fprintf(stderr, cRED "  Memory grew beyond %.1f%%" cNORM "\n", max_growth);
+      errcnt++;
+    }
+  }
+
+  for (i = 0; i < sigs.count; i++)
+    EVP_PKEY_free(server[i]);
+  for (i = 0; i < kems.count; i++)
+    OPENSSL_free(kems.list[i]);
+  for (i = 0; i < sigs.count; i++)
+    OPENSSL_free(sigs.list[i]);
+  OSSL_PROVIDER_unload(prov);
+  OSSL_LIB_CTX_free(libctx);
+  CRYPTO_secure_malloc_done();
+
+  TEST_ASSERT(errcnt == 0)
+  return !test;
+}
@@ -0,0 +1,304 @@
+// SPDX-License-Identifier: Apache-2.0 AND MIT
+
+/*
+ * Worst-case latency of decapsulation and signature verification.
+ *
+ * Feeds valid, random and crafted invalid ciphertexts/signatures to every
+ * KEM and signature algorithm of the provider and reports min, median,
+ * tail and maximum latency per input class. The provider reports some
+ * failures on stdout; that output is discarded while calls are timed so
+ * the terminal does not set the tail latency. Not run by ctest:
+ *
+ *    oqs_bench_worstcase <provider> <config> [iterations]
+ */
+
+#define _POSIX_C_SOURCE 200809L /* clock_gettime */
+
+#include <openssl/evp.h>
+#include <openssl/provider.h>
+#include <openssl/rand.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "test_common.h"
+
+static OSSL_LIB_CTX *libctx = NULL;
+static char *modulename = NULL;
+static char *configfile = NULL;
+static size_t iterations = 1000;
+static int stdout_fd = -1, null_fd = -1;
+
+/* Input classes: how a valid ciphertext/signature is mangled */
+enum {
+  CASE_VALID, CASE_RANDOM, CASE_FLIP_FIRST, CASE_FLIP_MIDDLE, CASE_FLIP_LAST,
+  CASE_ZERO, CASE_ONES, CASE_TRUNCATED, CASE_COUNT
+};
+
+static const char *case_names[CASE_COUNT] = {
+  "valid", "random", "flip-first", "flip-middle", "flip-last",
+  "all-zero", "all-ones", "truncated"
+};
+
+#define nelem(a) (sizeof(a)/sizeof((a)[0]))
+
+static double now_us(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* Sends stdout (the provider's error prints) to /dev/null while timing */
+static void quiet_begin(void)
+{
+  fflush(stdout);
+  if (null_fd >= 0)
+    dup2(null_fd, STDOUT_FILENO);
+}
+
+static void quiet_end(void)
+{
+  fflush(stdout);
+  if (stdout_fd >= 0)
+    dup2(stdout_fd, STDOUT_FILENO);
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+
+  return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, size_t n, double pct)
+{
+  size_t i = (size_t)(pct / 100.0 * (n - 1) + 0.5);
+
+  return sorted[i < n ? i : n - 1];
+}
+
+static void report(const char *alg, int c, double *lat, size_t n, size_t fails)
+{
+  qsort(lat, n, sizeof(*lat), cmp_double);
+  printf("%-28s %-12s %8.1f %8.1f %8.1f %8.1f %8.1f %6zu\n", alg, case_names[c],
+         lat[0], percentile(lat, n, 50), percentile(lat, n, 99),
+         percentile(lat, n, 99.9), lat[n - 1], fails);
+}
+
+/* Turns a copy of the valid input into the given class; returns its length */
+static size_t mangle(int c, unsigned char *buf, const unsigned char *valid, size_t len)
+{
+  memcpy(buf, valid, len);
+  switch (c) {
+  case CASE_RANDOM:
+    RAND_bytes(buf, (int)len);
+    break;
+  case CASE_FLIP_FIRST:
+    buf[0] ^= 0x01;
+    break;
+  case CASE_FLIP_MIDDLE:
+    buf[len / 2] ^= 0x80;
+    break;
+  case CASE_FLIP_LAST:
+    buf[len - 1] ^= 0x01;
+    break;
+  case CASE_ZERO:
+    memset(buf, 0, len);
+    break;
+  case CASE_ONES:
+    memset(buf, 0xff, len);
+    break;
+  case CASE_TRUNCATED:
+    return len / 2;
+  }
+  return len;
+}
+
+static EVP_PKEY *keygen(const char *alg)
+{
+  EVP_PKEY_CTX *ctx = NULL;
+  EVP_PKEY *key = NULL;
+
+  if ((ctx = EVP_PKEY_CTX_new_from_name(libctx, alg, NULL)) == NULL
+      || EVP_PKEY_keygen_init(ctx) <= 0
+      || EVP_PKEY_generate(ctx, &key) <= 0)
+    key = NULL;
+  EVP_PKEY_CTX_free(ctx);
+  return key;
+}
+
+static int bench_kem(const char *alg)
+{
+  EVP_PKEY *key = NULL;
+  EVP_PKEY_CTX *ctx = NULL;
+  unsigned char *ct = NULL, *bad = NULL, *secret = NULL;
+  size_t ctlen, secretlen, badlen, fails, i;
+  double *lat = NULL, t;
+  int c, ret = 0;
+
+  if ((key = keygen(alg)) == NULL
+      || (ctx = EVP_PKEY_CTX_new_from_pkey(libctx, key, NULL)) == NULL
+      || EVP_PKEY_encapsulate_init(ctx, NULL) <= 0
+      || EVP_PKEY_encapsulate(ctx, NULL, &ctlen, NULL, &secretlen) <= 0
+      || (ct = OPENSSL_malloc(ctlen)) == NULL
+      || (bad = OPENSSL_malloc(ctlen)) == NULL
+      || (secret = OPENSSL_malloc(secretlen)) == NULL
+      || (lat = OPENSSL_malloc(iterations * sizeof(*lat))) == NULL
+      || EVP_PKEY_encapsulate(ctx, ct, &ctlen, secret, &secretlen) <= 0
+      || EVP_PKEY_decapsulate_init(ctx, NULL) <= 0)
+    goto err;
+
+  for (c = 0; c < CASE_COUNT; c++) {
+    quiet_begin();
+    for (i = fails = 0; i < iterations; i++) {
+      size_t len = secretlen;
+
+      badlen = mangle(c, bad, ct, ctlen);
+      t = now_us();
+      if (EVP_PKEY_decapsulate(ctx, secret, &len, bad, badlen) <= 0)
+        fails++;
+      lat[i] = now_us() - t;
+    }
+    quiet_end();
+    ERR_clear_error();
+    report(alg, c, lat, iterations, fails);
+  }
+  ret = 1;
+
+  err:
+  OPENSSL_free(lat);
+  OPENSSL_clear_free(secret, secretlen);
+  OPENSSL_free(bad);
+  OPENSSL_free(ct);
+  EVP_PKEY_CTX_free(ctx);
+  EVP_PKEY_free(key);
+  return ret;
+}
+
+static int bench_sig(const char *alg)
+{
+  EVP_PKEY *key = NULL;
+  EVP_PKEY_CTX *ctx = NULL;
+  const unsigned char msg[] = "The quick brown fox jumps over... you know what";
+  unsigned char *sig = NULL, *bad = NULL;
+  size_t siglen, badlen, fails, i;
+  double *lat = NULL, t;
+  int c, ret = 0;
+
+  if ((key = keygen(alg)) == NULL
+      || (ctx = EVP_PKEY_CTX_new_from_pkey(libctx, key, NULL)) == NULL
+      || EVP_PKEY_sign_init(ctx) <= 0
+      || EVP_PKEY_sign(ctx, NULL, &siglen, msg, sizeof(msg)) <= 0
+      || (sig = OPENSSL_malloc(siglen)) == NULL
+      || (bad = OPENSSL_malloc(siglen)) == NULL
+      || (lat = OPENSSL_malloc(iterations * sizeof(*lat))) == NULL
+      || EVP_PKEY_sign(ctx, sig, &siglen, msg, sizeof(msg)) <= 0
+      || EVP_PKEY_verify_init(ctx) <= 0)
+    goto err;
+
+  for (c = 0; c < CASE_COUNT; c++) {
+    quiet_begin();
+    for (i = fails = 0; i < iterations; i++) {
+      badlen = mangle(c, bad, sig, siglen);
+      t = now_us();
+      if (EVP_PKEY_verify(ctx, bad, badlen, msg, sizeof(msg)) <= 0)
+        fails++;
+      lat[i] = now_us() - t;
+    }
+    quiet_end();
+    ERR_clear_error();
+    report(alg, c, lat, iterations, fails);
+  }
+  ret = 1;
+
+  err:
+  OPENSSL_free(lat);
+  OPENSSL_free(bad);
+  OPENSSL_free(sig);
+  EVP_PKEY_CTX_free(ctx);
+  EVP_PKEY_free(key);
+  return ret;
+}
+
+/* Collects the algorithm names implemented by the provider under test */
+struct names {
+  char *list[256];
+  size_t count;
+};
+
+static void collect_kem(EVP_KEM *kem, void *arg)
+{
+  struct names *names = arg;
+
+  if (names->count < nelem(names->list)
+      && !strcmp(OSSL_PROVIDER_get0_name(EVP_KEM_get0_provider(kem)), modulename))
+    names->list[names->count++] = OPENSSL_strdup(EVP_KEM_get0_name(kem));
+}
+
+static void collect_sig(EVP_SIGNATURE *sig, void *arg)
+{
+  struct names *names = arg;
+
+  if (names->count < nelem(names->list)
+      && !strcmp(OSSL_PROVIDER_get0_name(EVP_SIGNATURE_get0_provider(sig)), modulename))
+    names->list[names->count++] = OPENSSL_strdup(EVP_SIGNATURE_get0_name(sig));
+}
+
+int main(int argc, char *argv[])
+{
+  struct names kems = { { NULL }, 0 }, sigs = { { NULL }, 0 };
+  size_t i;
+  int errcnt = 0, test = 0;
+
+  T((libctx = OSSL_LIB_CTX_new()) != NULL);
+  T(argc == 3 || argc == 4);
+  modulename = argv[1];
+  configfile = argv[2];
+  if (argc == 4)
+    T((iterations = strtoul(argv[3], NULL, 10)) > 0);
+
+  T(OSSL_LIB_CTX_load_config(libctx, configfile));
+  T(OSSL_PROVIDER_available(libctx, modulename));
+
+  EVP_KEM_do_all_provided(libctx, collect_kem, &kems);
+  EVP_SIGNATURE_do_all_provided(libctx, collect_sig, &sigs);
+
+  if ((null_fd = open("/dev/null", O_WRONLY)) >= 0)
+    stdout_fd = dup(STDOUT_FILENO);
+  if (stdout_fd >= 0)
+    printf("# provider output on stdout discarded during timed calls\n");
+  else
+    printf("# WARNING: provider output on stdout included in timings\n");
+  printf("%-28s %-12s %8s %8s %8s %8s %8s %6s\n", "algorithm", "input",
+         "min_us", "p50_us", "p99_us", "p999_us", "max_us", "fails");
+  for (i = 0; i < kems.count; i++) {
+    if (kems.list[i] == NULL || !bench_kem(kems.list[i])) {
+      fprintf(stderr, cRED "  KEM benchmark failed: %s" cNORM "\n", kems.list[i]);
+      ERR_print_errors_fp(stderr);
+      errcnt++;
+    }
+  }
+  for (i = 0; i < sigs.count; i++) {
+    if (sigs.list[i] == NULL || !bench_sig(sigs.list[i])) {
+      fprintf(stderr, cRED "  Signature benchmark failed: %s" cNORM "\n", sigs.list[i]);
+      ERR_print_errors_fp(stderr);
+      errcnt++;
+    }
+  }
+
+  for (i = 0; i < kems.count; i++)
+    OPENSSL_free(kems.list[i]);
+  for (i = 0; i < sigs.count; i++)
+    OPENSSL_free(sigs.list[i]);
+  OSSL_LIB_CTX_free(libctx);
+  if (stdout_fd >= 0)
+    close(stdout_fd);
+  if (null_fd >= 0)
+    close(null_fd);
+
+  TEST_ASSERT(errcnt == 0)
+  return !test;
+}
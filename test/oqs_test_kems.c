@@ -0,0 +1,1025 @@
+// SPDX-License-Identifier: Apache-2.0 AND MIT
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <openssl/evp.h>
+#include <openssl/core_names.h>
+#include <openssl/params.h>
+#include <openssl/provider.h>
+#include "test_common.h"
+
+static OSSL_LIB_CTX *libctx = NULL;
+static char *modulename = NULL;
+static char *configfile = NULL;
+
+static const char *kemalg_names[] = {
+  "kyber512",
+  "kyber768",
+  "frodo640aes",
+  "p256_kyber512",
+  "x25519_kyber512",
+  "p384_kyber768",
+};
+
+/*
+ * Encapsulates to key and decapsulates the result in the library context
+ * ctx, passing the parameters given to either side; fails unless both ends
+ * obtain the same secret.
+ */
+static int kem_roundtrip_in(OSSL_LIB_CTX *lctx, EVP_PKEY *key,
+                            const OSSL_PARAM *eparams, const OSSL_PARAM *dparams)
+{
+  EVP_PKEY_CTX *ctx = NULL;
+  unsigned char *ct = NULL, *secenc = NULL, *secdec = NULL;
+  size_t ctlen, secenclen, secdeclen;
+
+  int testresult =
+    (ctx = EVP_PKEY_CTX_new_from_pkey(lctx, key, NULL)) != NULL
+    && EVP_PKEY_encapsulate_init(ctx, eparams)
+    && EVP_PKEY_encapsulate(ctx, NULL, &ctlen, NULL, &secenclen)
+    && (ct = OPENSSL_malloc(ctlen)) != NULL
+    && (secenc = OPENSSL_malloc(secenclen)) != NULL
+    && EVP_PKEY_encapsulate(ctx, ct, &ctlen, secenc, &secenclen)
+    && EVP_PKEY_decapsulate_init(ctx, dparams)
+    && EVP_PKEY_decapsulate(ctx, NULL, &secdeclen, ct, ctlen)
+    && (secdec = OPENSSL_malloc(secdeclen)) != NULL
+    && EVP_PKEY_decapsulate(ctx, secdec, &secdeclen, ct, ctlen)
+    && secenclen == secdeclen
+    && memcmp(secenc, secdec, secenclen) == 0;
+
+  OPENSSL_free(ct);
+  OPENSSL_free(secenc);
+  OPENSSL_free(secdec);
+  EVP_PKEY_CTX_free(ctx);
+  return testresult;
+}
+
+static int kem_roundtrip(EVP_PKEY *key, const OSSL_PARAM *eparams,
+                         const OSSL_PARAM *dparams)
+{
+  return kem_roundtrip_in(libctx, key, eparams, dparams);
+}
+
+static int test_oqs_kems(const char *kemalg_name)
+{
+  EVP_PKEY_CTX *ctx = NULL, *vctx = NULL;
+  EVP_PKEY *key = NULL;
+
+  int testresult =
+    (ctx = EVP_PKEY_CTX_new_from_name(libctx, kemalg_name, NULL)) != NULL
+    && EVP_PKEY_keygen_init(ctx)
+    && EVP_PKEY_generate(ctx, &key)
+    && (vctx = EVP_PKEY_CTX_new_from_pkey(libctx, key, NULL)) != NULL
+    && EVP_PKEY_check(vctx) > 0
+    && kem_roundtrip(key, NULL, NULL);
+
+  EVP_PKEY_free(key);
+  EVP_PKEY_CTX_free(vctx);
+  EVP_PKEY_CTX_free(ctx);
+  return testresult;
+}
+
+/*
+ * Encapsulation keeping its raw shared secret in a caller-supplied scratch
+ * buffer must derive the same output as decapsulation using the secure heap;
+ * the provider wipes what it carved, so the buffer loses its fill pattern.
+ */
+static int test_oqs_kem_scratch(const char *kemalg_name)
+{
+  EVP_PKEY_CTX *ctx = NULL, *ectx = NULL;
+  EVP_PKEY *key = NULL;
+  unsigned char scratch[512];
+  size_t scratchsize = 0;
+  char digest[] = "SHA256";
+  OSSL_PARAM gparams[] = {
+    OSSL_PARAM_size_t("oqs-scratch-size", &scratchsize),
+    OSSL_PARAM_END
+  };
+  OSSL_PARAM eparams[] = {
+    OSSL_PARAM_utf8_string("oqs-kdf-digest", digest, sizeof(digest) - 1),
+    OSSL_PARAM_octet_ptr("oqs-scratch", NULL, 0),
+    OSSL_PARAM_END
+  };
+  OSSL_PARAM dparams[] = {
+    OSSL_PARAM_utf8_string("oqs-kdf-digest", digest, sizeof(digest) - 1),
+    OSSL_PARAM_END
+  };
+  void *scratchptr = scratch;
+  int testresult;
+
+  memset(scratch, 0xa5, sizeof(scratch));
+  testresult =
+    (ctx = EVP_PKEY_CTX_new_from_name(libctx, kemalg_name, NULL)) != NULL
+    && EVP_PKEY_keygen_init(ctx)
+    && EVP_PKEY_generate(ctx, &key)
+    && (ectx = EVP_PKEY_CTX_new_from_pkey(libctx, key, NULL)) != NULL
+    && EVP_PKEY_encapsulate_init(ectx, NULL)
+    && EVP_PKEY_CTX_get_params(ectx, gparams)
+    && scratchsize == 0
+    && EVP_PKEY_encapsulate_init(ectx, dparams)
+    && EVP_PKEY_CTX_get_params(ectx, gparams)
+    && scratchsize > 0
+    && scratchsize <= sizeof(scratch);
+  if (testresult) {
+    eparams[1].data = &scratchptr;
+    eparams[1].data_size = scratchsize;
+    testresult = kem_roundtrip(key, eparams, dparams)
+      && scratch[0] != 0xa5
+      && scratch[scratchsize] == 0xa5;
+  }
+
+  EVP_PKEY_free(key);
+  EVP_PKEY_CTX_free(ectx);
+  EVP_PKEY_CTX_free(ctx);
+  return testresult;
+}
+
+/*
+ * Generates kemalg_name, reusing the classical keypair of sibling unless it
+ * is NULL: returns the new key, or NULL if the provider rejected the sibling.
+ */
+static EVP_PKEY *kem_keygen(const char *kemalg_name, EVP_PKEY *sibling)
+{
+  EVP_PKEY_CTX *ctx = NULL;
+  EVP_PKEY *key = NULL;
+  OSSL_PARAM params[] = {
+    OSSL_PARAM_octet_ptr("oqs-classical-sibling", NULL, 0),
+    OSSL_PARAM_END
+  };
+
+  params[0].data = &sibling;
+  params[0].data_size = sizeof(sibling);
+  if ((ctx = EVP_PKEY_CTX_new_from_name(libctx, kemalg_name, NULL)) == NULL
+      || !EVP_PKEY_keygen_init(ctx)
+      || (sibling != NULL && !EVP_PKEY_CTX_set_params(ctx, params))
+      || EVP_PKEY_generate(ctx, &key) <= 0)
+    key = NULL;
+  EVP_PKEY_CTX_free(ctx);
+  return key;
+}
+
+/* Whether the encoded public key of key contains that of classical */
+static int kem_has_classical(EVP_PKEY *key, EVP_PKEY *classical)
+{
+  unsigned char *pub = NULL, *cpub = NULL;
+  size_t publen, cpublen, i;
+  int found = 0;
+
+  if ((publen = EVP_PKEY_get1_encoded_public_key(key, &pub)) > 0
+      && (cpublen = EVP_PKEY_get1_encoded_public_key(classical, &cpub)) > 0)
+    for (i = 0; !found && i + cpublen <= publen; i++)
+      found = memcmp(pub + i, cpub, cpublen) == 0;
+  OPENSSL_free(pub);
+  OPENSSL_free(cpub);
+  return found;
+}
+
+/*
+ * Hybrid keys generated with a classical sibling take over its keypair, be
+ * it a plain classical key or another hybrid; siblings of another classical
+ * algorithm are rejected.
+ */
+static int test_oqs_kem_sibling(const char *kemalg_name)
+{
+  EVP_PKEY *classical = NULL, *other = NULL, *key = NULL, *key2 = NULL;
+  const char *curve = NULL;
+  int testresult;
+
+  if (!strncmp(kemalg_name, "p256_", 5))
+    curve = "P-256";
+  else if (!strncmp(kemalg_name, "p384_", 5))
+    curve = "P-384";
+  else if (strncmp(kemalg_name, "x25519_", 7))
+    return 1; // not a hybrid
+
+  testresult =
+    (classical = curve != NULL ? EVP_PKEY_Q_keygen(libctx, NULL, "EC", curve)
+                               : EVP_PKEY_Q_keygen(libctx, NULL, "X25519")) != NULL
+    && (other = curve != NULL ? EVP_PKEY_Q_keygen(libctx, NULL, "X448")
+                              : EVP_PKEY_Q_keygen(libctx, NULL, "EC", "P-521")) != NULL
+    && (key = kem_keygen(kemalg_name, classical)) != NULL
+    && kem_has_classical(key, classical)
+    && kem_roundtrip(key, NULL, NULL)
+    && (key2 = kem_keygen(kemalg_name, key)) != NULL
+    && kem_has_classical(key2, classical)
+    && kem_roundtrip(key2, NULL, NULL)
+    && kem_keygen(kemalg_name, other) == NULL;
+  if (testresult)
+    ERR_clear_error();
+
+  EVP_PKEY_free(classical);
+  EVP_PKEY_free(other);
+  EVP_PKEY_free(key);
+  EVP_PKEY_free(key2);
+  return testresult;
+}
+
+/* Returns a copy of the private key of key, NULL on errors */
+static unsigned char *get_privkey(EVP_PKEY *key, size_t *len)
+{
+  unsigned char *priv = NULL;
+
+  if (!EVP_PKEY_get_octet_string_param(key, OSSL_PKEY_PARAM_PRIV_KEY, NULL, 0, len)
+      || (priv = OPENSSL_malloc(*len)) == NULL
+      || !EVP_PKEY_get_octet_string_param(key, OSSL_PKEY_PARAM_PRIV_KEY, priv, *len, len)) {
+    OPENSSL_free(priv);
+    return NULL;
+  }
+  return priv;
+}
+
+/* Installs a keypair into key via oqs-rotate-priv/oqs-rotate-pub */
+static int rotate_key_to(EVP_PKEY *key, unsigned char *priv, size_t privlen,
+                         unsigned char *pub, size_t publen)
+{
+  OSSL_PARAM params[] = {
+    OSSL_PARAM_octet_string("oqs-rotate-priv", priv, privlen),
+    OSSL_PARAM_octet_string("oqs-rotate-pub", pub, publen),
+    OSSL_PARAM_END
+  };
+
+  return EVP_PKEY_set_params(key, params);
+}
+
+/* Installs the keypair of from into key */
+static int rotate_key(EVP_PKEY *key, EVP_PKEY *from)
+{
+  unsigned char *priv = NULL, *pub = NULL;
+  size_t privlen = 0, publen = 0;
+  int ret = 0;
+
+  if ((priv = get_privkey(from, &privlen)) != NULL
+      && (publen = EVP_PKEY_get1_encoded_public_key(from, &pub)) > 0)
+    ret = rotate_key_to(key, priv, privlen, pub, publen);
+  OPENSSL_clear_free(priv, privlen);
+  OPENSSL_free(pub);
+  return ret;
+}
+
+/*
+ * A key rotated twice (the first time replacing its initial material) must
+ * decapsulate what was encapsulated to its current keypair, and export it.
+ */
+static int test_oqs_kem_rotate(const char *kemalg_name)
+{
+  EVP_PKEY_CTX *ctx = NULL;
+  EVP_PKEY *key = NULL, *key1 = NULL, *key2 = NULL;
+  unsigned char *ct = NULL, *secenc = NULL, *secdec = NULL, *pub = NULL, *pub2 = NULL;
+  size_t ctlen, secenclen, secdeclen, publen, pub2len;
+
+  int testresult =
+    (key = kem_keygen(kemalg_name, NULL)) != NULL
+    && (key1 = kem_keygen(kemalg_name, NULL)) != NULL
+    && (key2 = kem_keygen(kemalg_name, NULL)) != NULL
+    && rotate_key(key, key1)
+    && rotate_key(key, key2)
+    && (ctx = EVP_PKEY_CTX_new_from_pkey(libctx, key2, NULL)) != NULL
+    && EVP_PKEY_encapsulate_init(ctx, NULL)
+    && EVP_PKEY_encapsulate(ctx, NULL, &ctlen, NULL, &secenclen)
+    && (ct = OPENSSL_malloc(ctlen)) != NULL
+    && (secenc = OPENSSL_malloc(secenclen)) != NULL
+    && EVP_PKEY_encapsulate(ctx, ct, &ctlen, secenc, &secenclen);
+  EVP_PKEY_CTX_free(ctx);
+  testresult = testresult
+    && (ctx = EVP_PKEY_CTX_new_from_pkey(libctx, key, NULL)) != NULL
+    && EVP_PKEY_decapsulate_init(ctx, NULL)
+    && EVP_PKEY_decapsulate(ctx, NULL, &secdeclen, ct, ctlen)
+    && (secdec = OPENSSL_malloc(secdeclen)) != NULL
+    && EVP_PKEY_decapsulate(ctx, secdec, &secdeclen, ct, ctlen)
+    && secdeclen == secenclen
+    && memcmp(secenc, secdec, secenclen) == 0
+    && kem_roundtrip(key, NULL, NULL)
+    && (publen = EVP_PKEY_get1_encoded_public_key(key, &pub)) > 0
+    && (pub2len = EVP_PKEY_get1_encoded_public_key(key2, &pub2)) > 0
+    && publen == pub2len
+    && memcmp(pub, pub2, publen) == 0
+    && EVP_PKEY_eq(key, key2) == 1;
+
+  OPENSSL_free(ct);
+  OPENSSL_free(secenc);
+  OPENSSL_free(secdec);
+  OPENSSL_free(pub);
+  OPENSSL_free(pub2);
+  EVP_PKEY_CTX_free(ctx);
+  EVP_PKEY_free(key);
+  EVP_PKEY_free(key1);
+  EVP_PKEY_free(key2);
+  return testresult;
+}
+
+/*
+ * Validation results are cached with the key material: replacing the public
+ * key, directly or by rotation, must drop them. Only Kyber components are
+ * checked beyond their length, so other algorithms merely pass.
+ */
+static int test_oqs_kem_revalidate(const char *kemalg_name)
+{
+  EVP_PKEY_CTX *ctx = NULL, *ctx2 = NULL;
+  EVP_PKEY *key = NULL, *key2 = NULL;
+  unsigned char *pub = NULL, *bad = NULL, *priv = NULL;
+  size_t publen = 0, privlen = 0;
+  int checked = strstr(kemalg_name, "kyber") != NULL;
+
+  int testresult =
+    (key = kem_keygen(kemalg_name, NULL)) != NULL
+    && (key2 = kem_keygen(kemalg_name, NULL)) != NULL
+    && (publen = EVP_PKEY_get1_encoded_public_key(key, &pub)) > 0
+    && (bad = OPENSSL_malloc(publen)) != NULL
+    && memset(bad, 0xff, publen) != NULL
+    && (priv = get_privkey(key, &privlen)) != NULL
+    && (ctx = EVP_PKEY_CTX_new_from_pkey(libctx, key, NULL)) != NULL
+    && (ctx2 = EVP_PKEY_CTX_new_from_pkey(libctx, key2, NULL)) != NULL
+    // replaced directly
+    && EVP_PKEY_public_check(ctx2) > 0
+    && EVP_PKEY_set1_encoded_public_key(key2, bad, publen)
+    && (EVP_PKEY_public_check(ctx2) > 0) != checked
+    // replaced by rotation, back and forth
+    && EVP_PKEY_public_check(ctx) > 0
+    && rotate_key_to(key, priv, privlen, bad, publen)
+    && (EVP_PKEY_public_check(ctx) > 0) != checked
+    && rotate_key_to(key, priv, privlen, pub, publen)
+    && EVP_PKEY_public_check(ctx) > 0
+    // once rotated, the material can only change by rotating again
+    && !EVP_PKEY_set1_encoded_public_key(key, pub, publen);
+  if (testresult)
+    ERR_clear_error();
+
+  OPENSSL_free(pub);
+  OPENSSL_free(bad);
+  OPENSSL_clear_free(priv, privlen);
+  EVP_PKEY_CTX_free(ctx);
+  EVP_PKEY_CTX_free(ctx2);
+  EVP_PKEY_free(key);
+  EVP_PKEY_free(key2);
+  return testresult;
+}
+
+/* Decapsulates ct with key in a fresh context; returns the secret length */
+static size_t kem_decaps(EVP_PKEY *key, const OSSL_PARAM *params,
+                         const unsigned char *ct, size_t ctlen,
+                         unsigned char *secret, size_t secretsize)
+{
+  EVP_PKEY_CTX *ctx = NULL;
+  size_t secretlen = secretsize;
+
+  if ((ctx = EVP_PKEY_CTX_new_from_pkey(libctx, key, NULL)) == NULL
+      || !EVP_PKEY_decapsulate_init(ctx, params)
+      || !EVP_PKEY_decapsulate(ctx, secret, &secretlen, ct, ctlen))
+    secretlen = 0;
+  EVP_PKEY_CTX_free(ctx);
+  return secretlen;
+}
+
+/*
+ * Both ends deriving their output with the same HKDF parameters obtain the
+ * same secret of the requested length; other parameters, or none, differ.
+ */
+static int test_oqs_kem_kdf(const char *kemalg_name)
+{
+  EVP_PKEY_CTX *ctx = NULL;
+  EVP_PKEY *key = NULL;
+  char digest[] = "SHA256";
+  char longdigest[] = "SHA256-with-a-name-longer-than-any-digest-name-there-is";
+  unsigned char salt[] = "salt", info[] = "oqs_test_kems", other[] = "other";
+  unsigned char *ct = NULL, secenc[48], secdec[64];
+  size_t ctlen, secenclen, kdflen = sizeof(secenc);
+  OSSL_PARAM params[] = {
+    OSSL_PARAM_utf8_string("oqs-kdf-digest", digest, sizeof(digest) - 1),
+    OSSL_PARAM_octet_string("oqs-kdf-salt", salt, sizeof(salt)),
+    OSSL_PARAM_octet_string("oqs-kdf-info", info, sizeof(info)),
+    OSSL_PARAM_size_t("oqs-kdf-len", &kdflen),
+    OSSL_PARAM_END
+  };
+  OSSL_PARAM otherparams[] = {
+    OSSL_PARAM_utf8_string("oqs-kdf-digest", digest, sizeof(digest) - 1),
+    OSSL_PARAM_octet_string("oqs-kdf-salt", salt, sizeof(salt)),
+    OSSL_PARAM_octet_string("oqs-kdf-info", other, sizeof(other)),
+    OSSL_PARAM_size_t("oqs-kdf-len", &kdflen),
+    OSSL_PARAM_END
+  };
+  OSSL_PARAM badparams[] = {
+    OSSL_PARAM_utf8_string("oqs-kdf-digest", longdigest, sizeof(longdigest) - 1),
+    OSSL_PARAM_END
+  };
+
+  int testresult =
+    (key = kem_keygen(kemalg_name, NULL)) != NULL
+    && (ctx = EVP_PKEY_CTX_new_from_pkey(libctx, key, NULL)) != NULL
+    && EVP_PKEY_encapsulate_init(ctx, params)
+    && EVP_PKEY_encapsulate(ctx, NULL, &ctlen, NULL, &secenclen)
+    && secenclen == kdflen
+    && (ct = OPENSSL_malloc(ctlen)) != NULL
+    && EVP_PKEY_encapsulate(ctx, ct, &ctlen, secenc, &secenclen)
+    && secenclen == kdflen
+    && kem_decaps(key, params, ct, ctlen, secdec, sizeof(secdec)) == kdflen
+    && memcmp(secenc, secdec, kdflen) == 0
+    && kem_decaps(key, otherparams, ct, ctlen, secdec, sizeof(secdec)) == kdflen
+    && memcmp(secenc, secdec, kdflen) != 0
+    && kem_decaps(key, NULL, ct, ctlen, secdec, sizeof(secdec)) > 0
+    && memcmp(secenc, secdec, kdflen) != 0
+    && !EVP_PKEY_CTX_set_params(ctx, badparams);
+  if (testresult)
+    ERR_clear_error();
+
+  OPENSSL_free(ct);
+  EVP_PKEY_CTX_free(ctx);
+  EVP_PKEY_free(key);
+  return testresult;
+}
+
+#define NUM_RECIPIENTS 3
+
+/*
+ * Encapsulates to several recipient public keys in one call, then has every
+ * recipient decapsulate its own share.
+ */
+static int test_oqs_kem_recipients(const char *kemalg_name)
+{
+  EVP_PKEY_CTX *ctx = NULL;
+  EVP_PKEY *key = NULL, *rkeys[NUM_RECIPIENTS] = { NULL };
+  unsigned char *pubs = NULL, *ct = NULL, *secret = NULL, *sec1 = NULL;
+  size_t publen = 0, ctlen, secretlen, ctlen1, secretlen1, sec1len, i;
+  OSSL_PARAM params[] = {
+    OSSL_PARAM_octet_string("oqs-recipients", NULL, 0),
+    OSSL_PARAM_END
+  };
+  int testresult = (key = kem_keygen(kemalg_name, NULL)) != NULL;
+
+  for (i = 0; testresult && i < NUM_RECIPIENTS; i++)
+    testresult =
+      (rkeys[i] = kem_keygen(kemalg_name, NULL)) != NULL
+      && EVP_PKEY_get_octet_string_param(rkeys[i], OSSL_PKEY_PARAM_PUB_KEY,
+                                         NULL, 0, &publen)
+      && (pubs != NULL || (pubs = OPENSSL_malloc(NUM_RECIPIENTS * publen)) != NULL)
+      && EVP_PKEY_get_octet_string_param(rkeys[i], OSSL_PKEY_PARAM_PUB_KEY,
+                                         pubs + i * publen, publen, &publen);
+  if (testresult) {
+    params[0].data = pubs;
+    params[0].data_size = NUM_RECIPIENTS * publen;
+    testresult =
+      (ctx = EVP_PKEY_CTX_new_from_pkey(libctx, key, NULL)) != NULL
+      && EVP_PKEY_encapsulate_init(ctx, params)
+      && EVP_PKEY_encapsulate(ctx, NULL, &ctlen, NULL, &secretlen)
+      && (ct = OPENSSL_malloc(ctlen)) != NULL
+      && (secret = OPENSSL_malloc(secretlen)) != NULL
+      && EVP_PKEY_encapsulate(ctx, ct, &ctlen, secret, &secretlen)
+      && ctlen % NUM_RECIPIENTS == 0
+      && secretlen % NUM_RECIPIENTS == 0;
+    ctlen1 = ctlen / NUM_RECIPIENTS;
+    secretlen1 = secretlen / NUM_RECIPIENTS;
+  }
+  for (i = 0; testresult && i < NUM_RECIPIENTS; i++) {
+    EVP_PKEY_CTX_free(ctx);
+    sec1len = secretlen1;
+    testresult =
+      (ctx = EVP_PKEY_CTX_new_from_pkey(libctx, rkeys[i], NULL)) != NULL
+      && EVP_PKEY_decapsulate_init(ctx, NULL)
+      && (sec1 != NULL || (sec1 = OPENSSL_malloc(secretlen1)) != NULL)
+      && EVP_PKEY_decapsulate(ctx, sec1, &sec1len, ct + i * ctlen1, ctlen1)
+      && sec1len == secretlen1
+      && memcmp(sec1, secret + i * secretlen1, secretlen1) == 0;
+  }
+
+  for (i = 0; i < NUM_RECIPIENTS; i++)
+    EVP_PKEY_free(rkeys[i]);
+  OPENSSL_free(pubs);
+  OPENSSL_free(ct);
+  OPENSSL_free(secret);
+  OPENSSL_free(sec1);
+  EVP_PKEY_free(key);
+  EVP_PKEY_CTX_free(ctx);
+  return testresult;
+}
+
+/* Queries the ciphertext and secret lengths of encapsulating to key */
+static int kem_lengths(EVP_PKEY *key, size_t *ctlen, size_t *secretlen)
+{
+  EVP_PKEY_CTX *ctx = NULL;
+  int ret =
+    (ctx = EVP_PKEY_CTX_new_from_pkey(libctx, key, NULL)) != NULL
+    && EVP_PKEY_encapsulate_init(ctx, NULL)
+    && EVP_PKEY_encapsulate(ctx, NULL, ctlen, NULL, secretlen);
+
+  EVP_PKEY_CTX_free(ctx);
+  return ret;
+}
+
+/*
+ * Hybrid ciphertexts and secrets concatenate those of their components:
+ * the classical part (an ECDH public key and shared secret) comes first.
+ * Ciphertexts of any other length are rejected.
+ */
+static int test_oqs_kem_layout(const char *kemalg_name)
+{
+  EVP_PKEY_CTX *ctx = NULL;
+  EVP_PKEY *key = NULL, *pqkey = NULL;
+  unsigned char *ct = NULL, secret[256];
+  size_t ctlen, secretlen, pqctlen, pqsecretlen, secretsize = sizeof(secret);
+  size_t classical_ctlen = 0, classical_secretlen = 0;
+  const char *pq = strchr(kemalg_name, '_');
+  int testresult;
+
+  if (!strncmp(kemalg_name, "p256_", 5)) {
+    classical_ctlen = 65;
+    classical_secretlen = 32;
+  } else if (!strncmp(kemalg_name, "p384_", 5)) {
+    classical_ctlen = 97;
+    classical_secretlen = 48;
+  } else if (!strncmp(kemalg_name, "x25519_", 7)) {
+    classical_ctlen = 32;
+    classical_secretlen = 32;
+  }
+
+  testresult =
+    (key = kem_keygen(kemalg_name, NULL)) != NULL
+    && kem_lengths(key, &ctlen, &secretlen)
+    && (pq == NULL
+        || ((pqkey = kem_keygen(pq + 1, NULL)) != NULL
+            && kem_lengths(pqkey, &pqctlen, &pqsecretlen)
+            && ctlen == classical_ctlen + pqctlen
+            && secretlen == classical_secretlen + pqsecretlen))
+    && (ct = OPENSSL_zalloc(ctlen + 1)) != NULL
+    && (ctx = EVP_PKEY_CTX_new_from_pkey(libctx, key, NULL)) != NULL
+    && EVP_PKEY_decapsulate_init(ctx, NULL)
+    && EVP_PKEY_decapsulate(ctx, secret, &secretsize, ct, ctlen - 1) <= 0
+    && EVP_PKEY_decapsulate(ctx, secret, &secretsize, ct, ctlen + 1) <= 0;
+  if (testresult)
+    ERR_clear_error();
+
+  OPENSSL_free(ct);
+  EVP_PKEY_CTX_free(ctx);
+  EVP_PKEY_free(key);
+  EVP_PKEY_free(pqkey);
+  return testresult;
+}
+
+/* Creates a key of kemalg_name from pub and, unless NULL, priv */
+static EVP_PKEY *kem_import(const char *kemalg_name, unsigned char *pub, size_t publen,
+                            unsigned char *priv, size_t privlen)
+{
+  EVP_PKEY_CTX *ctx = NULL;
+  EVP_PKEY *key = NULL;
+  OSSL_PARAM params[] = {
+    OSSL_PARAM_octet_string(OSSL_PKEY_PARAM_PUB_KEY, pub, publen),
+    OSSL_PARAM_octet_string(OSSL_PKEY_PARAM_PRIV_KEY, priv, privlen),
+    OSSL_PARAM_END
+  };
+
+  if (priv == NULL)
+    params[1] = OSSL_PARAM_construct_end();
+  if ((ctx = EVP_PKEY_CTX_new_from_name(libctx, kemalg_name, NULL)) == NULL
+      || EVP_PKEY_fromdata_init(ctx) <= 0
+      || EVP_PKEY_fromdata(ctx, &key, priv != NULL ? EVP_PKEY_KEYPAIR : EVP_PKEY_PUBLIC_KEY,
+                           params) <= 0)
+    key = NULL;
+  EVP_PKEY_CTX_free(ctx);
+  return key;
+}
+
+/*
+ * Keys that were never generated set up the parameters of their classical
+ * components on first use: an imported public key when encapsulating to it
+ * or checking it, an imported keypair when decapsulating.
+ */
+static int test_oqs_kem_import(const char *kemalg_name)
+{
+  EVP_PKEY_CTX *ctx = NULL;
+  EVP_PKEY *key = NULL, *pubkey = NULL, *checkkey = NULL, *pairkey = NULL;
+  unsigned char *pub = NULL, *priv = NULL, *ct = NULL, *secenc = NULL, secdec[256];
+  size_t publen = 0, privlen = 0, ctlen, secenclen;
+
+  int testresult =
+    (key = kem_keygen(kemalg_name, NULL)) != NULL
+    && EVP_PKEY_get_octet_string_param(key, OSSL_PKEY_PARAM_PUB_KEY, NULL, 0, &publen)
+    && (pub = OPENSSL_malloc(publen)) != NULL
+    && EVP_PKEY_get_octet_string_param(key, OSSL_PKEY_PARAM_PUB_KEY, pub, publen, &publen)
+    && (priv = get_privkey(key, &privlen)) != NULL
+    && (pubkey = kem_import(kemalg_name, pub, publen, NULL, 0)) != NULL
+    && (checkkey = kem_import(kemalg_name, pub, publen, NULL, 0)) != NULL
+    && (pairkey = kem_import(kemalg_name, pub, publen, priv, privlen)) != NULL
+    && (ctx = EVP_PKEY_CTX_new_from_pkey(libctx, checkkey, NULL)) != NULL
+    && EVP_PKEY_public_check(ctx) > 0;
+  EVP_PKEY_CTX_free(ctx);
+  ctx = NULL;
+  testresult = testresult
+    && (ctx = EVP_PKEY_CTX_new_from_pkey(libctx, pubkey, NULL)) != NULL
+    && EVP_PKEY_encapsulate_init(ctx, NULL)
+    && EVP_PKEY_encapsulate(ctx, NULL, &ctlen, NULL, &secenclen)
+    && (ct = OPENSSL_malloc(ctlen)) != NULL
+    && (secenc = OPENSSL_malloc(secenclen)) != NULL
+    && EVP_PKEY_encapsulate(ctx, ct, &ctlen, secenc, &secenclen)
+    && kem_decaps(pairkey, NULL, ct, ctlen, secdec, sizeof(secdec)) == secenclen
+    && memcmp(secenc, secdec, secenclen) == 0
+    && kem_decaps(key, NULL, ct, ctlen, secdec, sizeof(secdec)) == secenclen
+    && memcmp(secenc, secdec, secenclen) == 0;
+
+  OPENSSL_free(pub);
+  OPENSSL_clear_free(priv, privlen);
+  OPENSSL_free(ct);
+  OPENSSL_free(secenc);
+  EVP_PKEY_CTX_free(ctx);
+  EVP_PKEY_free(key);
+  EVP_PKEY_free(pubkey);
+  EVP_PKEY_free(checkkey);
+  EVP_PKEY_free(pairkey);
+  return testresult;
+}
+
+#define DEADLINE_EXCEEDED 1000 /* OQSPROV_R_DEADLINE_EXCEEDED */
+
+/* Whether the last error raised is a passed deadline */
+static int deadline_exceeded(void)
+{
+  unsigned long err = ERR_peek_last_error();
+
+  return ERR_GET_LIB(err) == ERR_LIB_PROV && ERR_GET_REASON(err) == DEADLINE_EXCEEDED;
+}
+
+/*
+ * Encapsulation and decapsulation with an oqs-deadline in the future work;
+ * once it has passed, both fail with OQSPROV_R_DEADLINE_EXCEEDED.
+ */
+static int test_oqs_kem_deadline(const char *kemalg_name)
+{
+  EVP_PKEY_CTX *ctx = NULL;
+  EVP_PKEY *key = NULL;
+  unsigned char *ct = NULL, *secret = NULL;
+  size_t ctlen, secretlen;
+  uint64_t past = 1, future = (uint64_t)time(NULL) * 1000 + 3600000;
+  OSSL_PARAM pastparams[] = {
+    OSSL_PARAM_uint64("oqs-deadline", &past),
+    OSSL_PARAM_END
+  };
+  OSSL_PARAM futureparams[] = {
+    OSSL_PARAM_uint64("oqs-deadline", &future),
+    OSSL_PARAM_END
+  };
+
+  int testresult =
+    (key = kem_keygen(kemalg_name, NULL)) != NULL
+    && kem_roundtrip(key, futureparams, futureparams)
+    && (ctx = EVP_PKEY_CTX_new_from_pkey(libctx, key, NULL)) != NULL
+    && EVP_PKEY_encapsulate_init(ctx, pastparams)
+    && EVP_PKEY_encapsulate(ctx, NULL, &ctlen, NULL, &secretlen)
+    && (ct = OPENSSL_zalloc(ctlen)) != NULL
+    && (secret = OPENSSL_malloc(secretlen)) != NULL
+    && EVP_PKEY_encapsulate(ctx, ct, &ctlen, secret, &secretlen) <= 0
+    && deadline_exceeded()
+    && EVP_PKEY_decapsulate_init(ctx, pastparams)
+    && EVP_PKEY_decapsulate(ctx, secret, &secretlen, ct, ctlen) <= 0
+    && deadline_exceeded();
+  if (testresult)
+    ERR_clear_error();
+
+  OPENSSL_free(ct);
+  OPENSSL_free(secret);
+  EVP_PKEY_CTX_free(ctx);
+  EVP_PKEY_free(key);
+  return testresult;
+}
+
+/*
+ * Loads the provider into a fresh library context, adding settings (lines of
+ * "name = value") to its configuration section. Returns the context whether
+ * or not the provider could be activated with these settings.
+ */
+static OSSL_LIB_CTX *load_provider(const char *settings)
+{
+  char conffile[] = "oqs_test_kems_XXXXXX";
+  OSSL_LIB_CTX *ctx = NULL;
+  FILE *f;
+  int fd;
+
+  if ((fd = mkstemp(conffile)) < 0)
+    return NULL;
+  if ((f = fdopen(fd, "w")) == NULL) {
+    close(fd);
+    unlink(conffile);
+    return NULL;
+  }
+  fprintf(f, "openssl_conf = openssl_init\n\n"
+             "[openssl_init]\nproviders = provider_sect\n\n"
+             "[provider_sect]\n%s = oqs_sect\ndefault = default_sect\n\n"
+             "[default_sect]\nactivate = 1\n\n"
+             "[oqs_sect]\nactivate = 1\n%s\n", modulename, settings);
+  if (fclose(f) == 0 && (ctx = OSSL_LIB_CTX_new()) != NULL)
+    OSSL_LIB_CTX_load_config(ctx, conffile);
+  unlink(conffile);
+  return ctx;
+}
+
+/* Generates a key in the library context ctx, NULL on errors */
+static EVP_PKEY *kem_keygen_in(OSSL_LIB_CTX *ctx, const char *kemalg_name)
+{
+  EVP_PKEY_CTX *gctx = NULL;
+  EVP_PKEY *key = NULL;
+
+  if ((gctx = EVP_PKEY_CTX_new_from_name(ctx, kemalg_name, NULL)) == NULL
+      || !EVP_PKEY_keygen_init(gctx)
+      || EVP_PKEY_generate(gctx, &key) <= 0)
+    key = NULL;
+  EVP_PKEY_CTX_free(gctx);
+  return key;
+}
+
+/* Reads a numeric parameter of the provider loaded into ctx */
+static int get_provider_param(OSSL_LIB_CTX *ctx, const char *name, uint64_t *value)
+{
+  OSSL_PROVIDER *prov = NULL;
+  OSSL_PARAM params[] = {
+    OSSL_PARAM_uint64(name, value),
+    OSSL_PARAM_END
+  };
+  int ret =
+    (prov = OSSL_PROVIDER_load(ctx, modulename)) != NULL
+    && OSSL_PROVIDER_get_params(prov, params)
+    && OSSL_PARAM_modified(params);
+
+  OSSL_PROVIDER_unload(prov);
+  return ret;
+}
+
+/*
+ * Provider instances share per-algorithm state: another instance using the
+ * algorithm and going away must leave it working for this one.
+ */
+static int test_oqs_kem_instances(const char *kemalg_name)
+{
+  OSSL_LIB_CTX *libctx2 = NULL;
+  EVP_PKEY *key = NULL, *key2 = NULL;
+
+  int testresult =
+    (key = kem_keygen(kemalg_name, NULL)) != NULL
+    && (libctx2 = load_provider("")) != NULL
+    && OSSL_PROVIDER_available(libctx2, modulename)
+    && (key2 = kem_keygen_in(libctx2, kemalg_name)) != NULL;
+  EVP_PKEY_free(key2);
+  OSSL_LIB_CTX_free(libctx2);
+  key2 = NULL;
+  testresult = testresult
+    && kem_roundtrip(key, NULL, NULL)
+    && (key2 = kem_keygen(kemalg_name, NULL)) != NULL
+    && kem_roundtrip(key2, NULL, NULL);
+
+  EVP_PKEY_free(key);
+  EVP_PKEY_free(key2);
+  return testresult;
+}
+
+#define REUSE_USES 3
+#define REUSE_MS   100
+
+/*
+ * With ephemeral reuse configured, key generation hands out the same key
+ * until either limit is reached, counting fresh and reused keys.
+ */
+static int test_oqs_kem_reuse(const char *kemalg_name)
+{
+  OSSL_LIB_CTX *ctxuses = NULL, *ctxms = NULL;
+  EVP_PKEY *keys[REUSE_USES + 1] = { NULL }, *key = NULL, *key2 = NULL;
+  uint64_t keygens = 0, reuses = 0;
+  struct timespec wait = { 0, 3 * REUSE_MS / 2 * 1000000L };
+  char uses[128], ms[128];
+  size_t i;
+  int testresult;
+
+  snprintf(uses, sizeof(uses),
+           "ephemeral_reuse_uses = %d\nephemeral_reuse_ms = 3600000", REUSE_USES);
+  snprintf(ms, sizeof(ms),
+           "ephemeral_reuse_uses = 1000\nephemeral_reuse_ms = %d", REUSE_MS);
+  testresult =
+    (ctxuses = load_provider(uses)) != NULL
+    && OSSL_PROVIDER_available(ctxuses, modulename)
+    && (ctxms = load_provider(ms)) != NULL
+    && OSSL_PROVIDER_available(ctxms, modulename);
+
+  // limited by uses
+  for (i = 0; testresult && i < REUSE_USES + 1; i++)
+    testresult = (keys[i] = kem_keygen_in(ctxuses, kemalg_name)) != NULL
+                 && EVP_PKEY_eq(keys[i], keys[0]) == (i < REUSE_USES);
+  testresult = testresult
+    && get_provider_param(ctxuses, "oqs-kem-keygens", &keygens)
+    && get_provider_param(ctxuses, "oqs-kem-reuses", &reuses)
+    && keygens == 2
+    && reuses == REUSE_USES - 1
+    // limited by time
+    && (key = kem_keygen_in(ctxms, kemalg_name)) != NULL
+    && (key2 = kem_keygen_in(ctxms, kemalg_name)) != NULL
+    && EVP_PKEY_eq(key, key2) == 1;
+  EVP_PKEY_free(key2);
+  key2 = NULL;
+  testresult = testresult
+    && nanosleep(&wait, NULL) == 0
+    && (key2 = kem_keygen_in(ctxms, kemalg_name)) != NULL
+    && EVP_PKEY_eq(key, key2) != 1
+    && get_provider_param(ctxms, "oqs-kem-reuses", &reuses)
+    && reuses == 1;
+
+  for (i = 0; i < REUSE_USES + 1; i++)
+    EVP_PKEY_free(keys[i]);
+  EVP_PKEY_free(key);
+  EVP_PKEY_free(key2);
+  OSSL_LIB_CTX_free(ctxuses);
+  OSSL_LIB_CTX_free(ctxms);
+  return testresult;
+}
+
+/* Generates domain parameters in the library context ctx, NULL on errors */
+static EVP_PKEY *kem_paramgen_in(OSSL_LIB_CTX *ctx, const char *kemalg_name)
+{
+  EVP_PKEY_CTX *gctx = NULL;
+  EVP_PKEY *params = NULL;
+
+  if ((gctx = EVP_PKEY_CTX_new_from_name(ctx, kemalg_name, NULL)) == NULL
+      || EVP_PKEY_paramgen_init(gctx) <= 0
+      || EVP_PKEY_paramgen(gctx, &params) <= 0)
+    params = NULL;
+  EVP_PKEY_CTX_free(gctx);
+  return params;
+}
+
+/*
+ * Keys handed out by ephemeral reuse are independent copies: replacing the
+ * public key of one leaves the others, and keys reused later, intact.
+ * Parameter generation never takes or replaces the reused key.
+ */
+static int test_oqs_kem_reuse_copies(const char *kemalg_name)
+{
+  OSSL_LIB_CTX *ctx = NULL;
+  EVP_PKEY *key = NULL, *key2 = NULL, *key3 = NULL, *key4 = NULL;
+  EVP_PKEY *other = NULL, *params = NULL;
+  unsigned char *pub = NULL;
+  size_t publen;
+  uint64_t reuses = 0, reuses2 = 0;
+
+  int testresult =
+    (ctx = load_provider("ephemeral_reuse_uses = 1000\n"
+                         "ephemeral_reuse_ms = 3600000")) != NULL
+    && OSSL_PROVIDER_available(ctx, modulename)
+    && (other = kem_keygen(kemalg_name, NULL)) != NULL
+    && (publen = EVP_PKEY_get1_encoded_public_key(other, &pub)) > 0
+    && (key = kem_keygen_in(ctx, kemalg_name)) != NULL
+    && (key2 = kem_keygen_in(ctx, kemalg_name)) != NULL
+    && EVP_PKEY_eq(key, key2) == 1
+    && EVP_PKEY_set1_encoded_public_key(key2, pub, publen)
+    && EVP_PKEY_eq(key, key2) != 1
+    && kem_roundtrip_in(ctx, key, NULL, NULL)
+    && (key3 = kem_keygen_in(ctx, kemalg_name)) != NULL
+    && EVP_PKEY_eq(key, key3) == 1
+    && kem_roundtrip_in(ctx, key3, NULL, NULL)
+    && get_provider_param(ctx, "oqs-kem-reuses", &reuses)
+    && (params = kem_paramgen_in(ctx, kemalg_name)) != NULL
+    && get_provider_param(ctx, "oqs-kem-reuses", &reuses2)
+    && reuses2 == reuses
+    && (key4 = kem_keygen_in(ctx, kemalg_name)) != NULL
+    && EVP_PKEY_eq(key, key4) == 1;
+
+  OPENSSL_free(pub);
+  EVP_PKEY_free(key);
+  EVP_PKEY_free(key2);
+  EVP_PKEY_free(key3);
+  EVP_PKEY_free(key4);
+  EVP_PKEY_free(other);
+  EVP_PKEY_free(params);
+  OSSL_LIB_CTX_free(ctx);
+  return testresult;
+}
+
+/* Whether the provider can be activated with settings */
+static int provider_loads(const char *settings)
+{
+  OSSL_LIB_CTX *ctx = load_provider(settings);
+  int ret = ctx != NULL && OSSL_PROVIDER_available(ctx, modulename);
+
+  OSSL_LIB_CTX_free(ctx);
+  return ret;
+}
+
+/*
+ * Backend selections naming unknown backends, or malformed, keep the
+ * provider from loading. Valid ones may name algorithms that do not exist;
+ * algorithms not named use the default backend.
+ */
+static int test_oqs_kem_backends(const char *kemalg_name)
+{
+  OSSL_LIB_CTX *ctx = NULL;
+  EVP_PKEY *key = NULL;
+
+  int testresult =
+    !provider_loads("backend = nosuch")
+    && !provider_loads("backends = Kyber512:nosuch")
+    && !provider_loads("backends = Kyber512")
+    && !provider_loads("backends = :liboqs")
+    && !provider_loads("backends = Kyber512:liboqs, Kyber768:")
+    && provider_loads("backend = liboqs")
+    && (ctx = load_provider("backend = liboqs\n"
+                            "backends = Kyber512 : liboqs, NoSuchAlgorithm:liboqs, ")) != NULL
+    && OSSL_PROVIDER_available(ctx, modulename)
+    && (key = kem_keygen_in(ctx, kemalg_name)) != NULL
+    && kem_roundtrip_in(ctx, key, NULL, NULL);
+  if (testresult)
+    ERR_clear_error();
+
+  EVP_PKEY_free(key);
+  OSSL_LIB_CTX_free(ctx);
+  return testresult;
+}
+
+/*
+ * A private key arena, once configured by any provider instance, holds the
+ * private keys generated afterwards and takes them back when they are freed.
+ * Sizes too small for an arena do not keep the provider from loading.
+ */
+static int test_oqs_kem_arena(const char *kemalg_name)
+{
+  OSSL_LIB_CTX *ctx = NULL;
+  EVP_PKEY *key = NULL;
+  uint64_t size = 0, used = 0, used2 = 0, used3 = 0;
+
+  int testresult =
+    provider_loads("secure_arena_size = 1000")
+    && !provider_loads("secure_arena_size = 1M")
+    && (ctx = load_provider("secure_arena_size = 1048576")) != NULL
+    && OSSL_PROVIDER_available(ctx, modulename)
+    && get_provider_param(ctx, "oqs-arena-size", &size)
+    && get_provider_param(ctx, "oqs-arena-used", &used)
+#if defined(__linux__)
+    && size >= 1048576
+    && (key = kem_keygen_in(ctx, kemalg_name)) != NULL
+    && get_provider_param(ctx, "oqs-arena-used", &used2)
+    && used2 > used;
+#else
+    && size == 0;
+#endif
+  EVP_PKEY_free(key);
+  testresult = testresult
+    && get_provider_param(ctx, "oqs-arena-used", &used3)
+    && used3 == used;
+  if (testresult)
+    ERR_clear_error();
+
+  OSSL_LIB_CTX_free(ctx);
+  return testresult;
+}
+
+#define nelem(a) (sizeof(a)/sizeof((a)[0]))
+
+static int run_tests(const char *what, int (*fn)(const char *))
+{
+  size_t i;
+  int errcnt = 0;
+
+  for (i = 0; i < nelem(kemalg_names); i++) {
+    if (fn(kemalg_names[i])) {
+      fprintf(stderr,
+              cGREEN "  %s test succeeded: %s" cNORM "\n",
+              what, kemalg_names[i]);
+    } else {
+      fprintf(stderr,
+              cRED "  %s test failed: %s" cNORM "\n",
+              what, kemalg_names[i]);
+      ERR_print_errors_fp(stderr);
+      errcnt++;
+    }
+  }
+  return errcnt;
+}
+
+int main(int argc, char *argv[])
+{
+  int errcnt = 0, test = 0;
+
+  T((libctx = OSSL_LIB_CTX_new()) != NULL);
+  T(argc == 3);
+  modulename = argv[1];
+  configfile = argv[2];
+
+  T(OSSL_LIB_CTX_load_config(libctx, configfile));
+
+  T(OSSL_PROVIDER_available(libctx, modulename));
+  T(OSSL_PROVIDER_available(libctx, "default"));
+
+  errcnt += run_tests("KEM", test_oqs_kems);
+  errcnt += run_tests("KEM scratch", test_oqs_kem_scratch);
+  errcnt += run_tests("KEM sibling", test_oqs_kem_sibling);
+  errcnt += run_tests("KEM layout", test_oqs_kem_layout);
+  errcnt += run_tests("KEM recipients", test_oqs_kem_recipients);
+  errcnt += run_tests("KEM rotation", test_oqs_kem_rotate);
+  errcnt += run_tests("KEM revalidation", test_oqs_kem_revalidate);
+  errcnt += run_tests("KEM KDF", test_oqs_kem_kdf);
+  errcnt += run_tests("KEM import", test_oqs_kem_import);
+  errcnt += run_tests("KEM deadline", test_oqs_kem_deadline);
+  errcnt += run_tests("KEM provider instances", test_oqs_kem_instances);
+  errcnt += run_tests("KEM ephemeral reuse", test_oqs_kem_reuse);
+  errcnt += run_tests("KEM ephemeral reuse copies", test_oqs_kem_reuse_copies);
+  errcnt += run_tests("KEM backends", test_oqs_kem_backends);
+  errcnt += run_tests("KEM arena", test_oqs_kem_arena);
+
+  OSSL_LIB_CTX_free(libctx);
+
+  TEST_ASSERT(errcnt == 0)
+  return !test;
+}
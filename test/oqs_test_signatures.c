@@ -1,6 +1,10 @@
 // SPDX-License-Identifier: Apache-2.0 AND MIT
 
+#include <string.h>
+#include <time.h>
+#include <openssl/core_names.h>
 #include <openssl/evp.h>
+#include <openssl/params.h>
 #include <openssl/provider.h>
 #include "test_common.h"
 
@@ -37,7 +41,7 @@ static const char *sigalg_names[] = {
 static int test_oqs_signatures(const char *sigalg_name)
 {
   EVP_MD_CTX *mdctx = NULL;
-  EVP_PKEY_CTX *ctx = NULL;
+  EVP_PKEY_CTX *ctx = NULL, *vctx = NULL;
   EVP_PKEY *key = NULL;
   const char msg[] = "The quick brown fox jumps over... you know what";
   unsigned char *sig;
@@ -48,6 +52,8 @@ static int test_oqs_signatures(const char *sigalg_name)
     && (ctx = EVP_PKEY_CTX_new_from_name(libctx, sigalg_name, NULL)) != NULL
     && EVP_PKEY_keygen_init(ctx)
     && EVP_PKEY_gen(ctx, &key)
+    && (vctx = EVP_PKEY_CTX_new_from_pkey(libctx, key, NULL)) != NULL
+    && EVP_PKEY_check(vctx) > 0
     && EVP_DigestSignInit_ex(mdctx, NULL, "SHA512", libctx, NULL, key, NULL)
     && EVP_DigestSignUpdate(mdctx, msg, sizeof(msg))
     && EVP_DigestSignFinal(mdctx, NULL, &siglen)
@@ -59,10 +65,171 @@ static int test_oqs_signatures(const char *sigalg_name)
 
   EVP_MD_CTX_free(mdctx);
   EVP_PKEY_free(key);
+  EVP_PKEY_CTX_free(vctx);
   OPENSSL_free(ctx);
   return testresult;
 }
 
+static EVP_PKEY *keygen(const char *sigalg_name)
+{
+  EVP_PKEY_CTX *ctx = NULL;
+  EVP_PKEY *key = NULL;
+
+  if ((ctx = EVP_PKEY_CTX_new_from_name(libctx, sigalg_name, NULL)) == NULL
+      || !EVP_PKEY_keygen_init(ctx)
+      || EVP_PKEY_generate(ctx, &key) <= 0)
+    key = NULL;
+  EVP_PKEY_CTX_free(ctx);
+  return key;
+}
+
+/* Returns a copy of an octet string key parameter, NULL on errors */
+static unsigned char *get_key_param(EVP_PKEY *key, const char *name, size_t *len)
+{
+  unsigned char *buf = NULL;
+
+  if (!EVP_PKEY_get_octet_string_param(key, name, NULL, 0, len)
+      || (buf = OPENSSL_malloc(*len)) == NULL
+      || !EVP_PKEY_get_octet_string_param(key, name, buf, *len, len)) {
+    OPENSSL_free(buf);
+    return NULL;
+  }
+  return buf;
+}
+
+/* Installs the keypair of from into key via oqs-rotate-priv/oqs-rotate-pub */
+static int rotate_key(EVP_PKEY *key, EVP_PKEY *from)
+{
+  unsigned char *priv = NULL, *pub = NULL;
+  size_t privlen, publen;
+  OSSL_PARAM params[3];
+  int ret = 0;
+
+  if ((priv = get_key_param(from, OSSL_PKEY_PARAM_PRIV_KEY, &privlen)) != NULL
+      && (pub = get_key_param(from, OSSL_PKEY_PARAM_PUB_KEY, &publen)) != NULL) {
+    params[0] = OSSL_PARAM_construct_octet_string("oqs-rotate-priv", priv, privlen);
+    params[1] = OSSL_PARAM_construct_octet_string("oqs-rotate-pub", pub, publen);
+    params[2] = OSSL_PARAM_construct_end();
+    ret = EVP_PKEY_set_params(key, params);
+  }
+  OPENSSL_free(priv);
+  OPENSSL_free(pub);
+  return ret;
+}
+
+/*
+ * Rotates a key twice, the first rotation replacing its initial material;
+ * the key must then sign like, compare equal to and export the keypair it
+ * was last given, and refuse having its public key replaced directly.
+ */
+static int test_oqs_signatures_rotate(const char *sigalg_name)
+{
+  EVP_MD_CTX *mdctx = NULL;
+  EVP_PKEY *key = NULL, *key1 = NULL, *key2 = NULL;
+  const char msg[] = "The quick brown fox jumps over... you know what";
+  unsigned char *sig = NULL, *pub = NULL, *pub2 = NULL, *priv = NULL, *priv2 = NULL;
+  size_t siglen, publen, pub2len, privlen, priv2len;
+
+  int testresult =
+    (mdctx = EVP_MD_CTX_new()) != NULL
+    && (key = keygen(sigalg_name)) != NULL
+    && (key1 = keygen(sigalg_name)) != NULL
+    && (key2 = keygen(sigalg_name)) != NULL
+    && rotate_key(key, key1)
+    && rotate_key(key, key2)
+    && EVP_PKEY_eq(key, key2) == 1
+    && EVP_PKEY_eq(key, key1) != 1
+    && EVP_DigestSignInit_ex(mdctx, NULL, "SHA512", libctx, NULL, key, NULL)
+    && EVP_DigestSignUpdate(mdctx, msg, sizeof(msg))
+    && EVP_DigestSignFinal(mdctx, NULL, &siglen)
+    && (sig = OPENSSL_malloc(siglen)) != NULL
+    && EVP_DigestSignFinal(mdctx, sig, &siglen)
+    && EVP_DigestVerifyInit_ex(mdctx, NULL, "SHA512", libctx, NULL, key2, NULL)
+    && EVP_DigestVerifyUpdate(mdctx, msg, sizeof(msg))
+    && EVP_DigestVerifyFinal(mdctx, sig, siglen)
+    && (publen = EVP_PKEY_get1_encoded_public_key(key, &pub)) > 0
+    && (pub2len = EVP_PKEY_get1_encoded_public_key(key2, &pub2)) > 0
+    && publen == pub2len
+    && memcmp(pub, pub2, publen) == 0
+    && (priv = get_key_param(key, OSSL_PKEY_PARAM_PRIV_KEY, &privlen)) != NULL
+    && (priv2 = get_key_param(key2, OSSL_PKEY_PARAM_PRIV_KEY, &priv2len)) != NULL
+    && privlen == priv2len
+    && memcmp(priv, priv2, privlen) == 0
+    && !EVP_PKEY_set1_encoded_public_key(key, pub2, pub2len);
+  if (testresult)
+    ERR_clear_error();
+
+  OPENSSL_free(priv);
+  OPENSSL_free(priv2);
+  OPENSSL_free(sig);
+  OPENSSL_free(pub);
+  OPENSSL_free(pub2);
+  EVP_MD_CTX_free(mdctx);
+  EVP_PKEY_free(key);
+  EVP_PKEY_free(key1);
+  EVP_PKEY_free(key2);
+  return testresult;
+}
+
+#define DEADLINE_EXCEEDED 1000 /* OQSPROV_R_DEADLINE_EXCEEDED */
+
+/* Whether the last error raised is a passed deadline */
+static int deadline_exceeded(void)
+{
+  unsigned long err = ERR_peek_last_error();
+
+  return ERR_GET_LIB(err) == ERR_LIB_PROV && ERR_GET_REASON(err) == DEADLINE_EXCEEDED;
+}
+
+/*
+ * Signing and verification with an oqs-deadline in the future work; once it
+ * has passed, both fail with OQSPROV_R_DEADLINE_EXCEEDED.
+ */
+static int test_oqs_signatures_deadline(const char *sigalg_name)
+{
+  EVP_MD_CTX *mdctx = NULL;
+  EVP_PKEY *key = NULL;
+  const char msg[] = "The quick brown fox jumps over... you know what";
+  unsigned char *sig = NULL;
+  size_t siglen;
+  uint64_t past = 1, future = (uint64_t)time(NULL) * 1000 + 3600000;
+  OSSL_PARAM pastparams[] = {
+    OSSL_PARAM_uint64("oqs-deadline", &past),
+    OSSL_PARAM_END
+  };
+  OSSL_PARAM futureparams[] = {
+    OSSL_PARAM_uint64("oqs-deadline", &future),
+    OSSL_PARAM_END
+  };
+
+  int testresult =
+    (mdctx = EVP_MD_CTX_new()) != NULL
+    && (key = keygen(sigalg_name)) != NULL
+    && EVP_DigestSignInit_ex(mdctx, NULL, "SHA512", libctx, NULL, key, futureparams)
+    && EVP_DigestSignUpdate(mdctx, msg, sizeof(msg))
+    && EVP_DigestSignFinal(mdctx, NULL, &siglen)
+    && (sig = OPENSSL_malloc(siglen)) != NULL
+    && EVP_DigestSignFinal(mdctx, sig, &siglen)
+    && EVP_DigestVerifyInit_ex(mdctx, NULL, "SHA512", libctx, NULL, key, futureparams)
+    && EVP_DigestVerifyUpdate(mdctx, msg, sizeof(msg))
+    && EVP_DigestVerifyFinal(mdctx, sig, siglen)
+    && EVP_DigestSignInit_ex(mdctx, NULL, "SHA512", libctx, NULL, key, pastparams)
+    && EVP_DigestSignUpdate(mdctx, msg, sizeof(msg))
+    && EVP_DigestSignFinal(mdctx, sig, &siglen) <= 0
+    && deadline_exceeded()
+    && EVP_DigestVerifyInit_ex(mdctx, NULL, "SHA512", libctx, NULL, key, pastparams)
+    && EVP_DigestVerifyUpdate(mdctx, msg, sizeof(msg))
+    && EVP_DigestVerifyFinal(mdctx, sig, siglen) <= 0
+    && deadline_exceeded();
+  if (testresult)
+    ERR_clear_error();
+
+  OPENSSL_free(sig);
+  EVP_MD_CTX_free(mdctx);
+  EVP_PKEY_free(key);
+  return testresult;
+}
+
 #define nelem(a) (sizeof(a)/sizeof((a)[0]))
 
 int main(int argc, char *argv[])
@@ -99,6 +266,34 @@ int main(int argc, char *argv[])
     }
   }
 
+  for (i = 0; i < nelem(sigalg_names); i++) {
+    if (test_oqs_signatures_rotate(sigalg_names[i])) {
+      fprintf(stderr,
+              cGREEN "  Signature rotation test succeeded: %s" cNORM "\n",
+              sigalg_names[i]);
+    } else {
+      fprintf(stderr,
+              cRED "  Signature rotation test failed: %s" cNORM "\n",
+              sigalg_names[i]);
+      ERR_print_errors_fp(stderr);
+      errcnt++;
+    }
+  }
+
+  for (i = 0; i < nelem(sigalg_names); i++) {
+    if (test_oqs_signatures_deadline(sigalg_names[i])) {
+      fprintf(stderr,
+              cGREEN "  Signature deadline test succeeded: %s" cNORM "\n",
+              sigalg_names[i]);
+    } else {
+      fprintf(stderr,
+              cRED "  Signature deadline test failed: %s" cNORM "\n",
+              sigalg_names[i]);
+      ERR_print_errors_fp(stderr);
+      errcnt++;
+    }
+  }
+
   OSSL_LIB_CTX_free(libctx);
 
   TEST_ASSERT(errcnt == 0)
@@ -0,0 +1,394 @@
+// SPDX-License-Identifier: Apache-2.0 AND MIT
+
+/*
+ * Replays an operation trace captured with OQSPROV_TRACE=<file> (see
+ * OQSX_TRACE_REC in oqsprov/oqsx.h) against the provider:
+ *
+ *    oqs_trace_replay <provider> <config> <trace> [speed] [threads]
+ *
+ * Records keep their algorithm, operation, sizes and relative start times;
+ * speed scales the timeline (default 1, 0 = back to back). Records of each
+ * captured thread are replayed by one of the replay threads (default 1).
+ * Operations that failed when captured are skipped, as their cost is not
+ * that of a successful one. Key material is generated here, as the trace
+ * contains none.
+ */
+
+#define _POSIX_C_SOURCE 200809L /* clock_gettime, clock_nanosleep */
+
+#include <openssl/evp.h>
+#include <openssl/provider.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "test_common.h"
+
+/* Must match oqsprov/oqsx.h */
+#define TRACE_MAGIC     "OQSTRC2\n"
+#define TRACE_MAX_NAMES 256
+
+enum {
+  OP_NAME, OP_KEYGEN, OP_ENCAPS, OP_DECAPS, OP_SIGN, OP_VERIFY, OP_COUNT
+};
+
+static const char *op_names[OP_COUNT] = {
+  "", "keygen", "encaps", "decaps", "sign", "verify"
+};
+
+struct trace_rec {
+  uint64_t time_ns;
+  uint64_t thread;
+  uint64_t duration_ns;
+  uint32_t in_len;
+  uint32_t out_len;
+  uint16_t alg;
+  uint8_t op;
+  uint8_t ok;
+};
+
+/* Per algorithm: a key, a ciphertext for it and signatures by message length */
+struct sig_cache {
+  size_t msglen;
+  unsigned char *sig;
+  size_t siglen;
+};
+
+struct alg {
+  char *name;
+  EVP_PKEY *key;
+  unsigned char *ct;
+  size_t ctlen;
+  struct sig_cache *sigs;
+  size_t nsigs;
+};
+
+struct stats {
+  size_t count, fails;
+  double total_us, max_us, traced_us;
+};
+
+struct worker {
+  pthread_t thread;
+  size_t index;
+  struct stats stats[TRACE_MAX_NAMES][OP_COUNT];
+};
+
+static OSSL_LIB_CTX *libctx = NULL;
+static char *modulename = NULL;
+static char *configfile = NULL;
+static struct alg algs[TRACE_MAX_NAMES];
+static size_t nalgs = 0;
+static struct trace_rec *recs = NULL;
+static size_t nrecs = 0;
+static size_t nfailed = 0;
+static double speed = 1.0;
+static size_t nthreads = 1;
+static uint64_t start_ns;
+static unsigned char msgbuf[1 << 16];
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t t)
+{
+  struct timespec ts;
+
+  ts.tv_sec = t / 1000000000;
+  ts.tv_nsec = t % 1000000000;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0)
+    ;
+}
+
+/*
+ * Captured thread ids are opaque (often aligned pointers): number them in
+ * order of appearance so they spread evenly over the replay threads.
+ */
+static uint64_t thread_index(uint64_t id)
+{
+  static uint64_t ids[4096];
+  static size_t nids = 0;
+  size_t i;
+
+  for (i = 0; i < nids; i++)
+    if (ids[i] == id)
+      return i;
+  if (nids < sizeof(ids) / sizeof(ids[0]))
+    ids[nids++] = id;
+  return i;
+}
+
+static int read_trace(const char *path)
+{
+  FILE *f = fopen(path, "rb");
+  char magic[sizeof(TRACE_MAGIC) - 1];
+  struct trace_rec rec;
+  size_t cap = 0;
+  int ret = 0;
+
+  if (f == NULL || fread(magic, 1, sizeof(magic), f) != sizeof(magic)
+      || memcmp(magic, TRACE_MAGIC, sizeof(magic)))
+    goto err;
+  while (fread(&rec, sizeof(rec), 1, f) == 1) {
+    if (rec.op == OP_NAME) {
+      if (rec.alg != nalgs || nalgs == TRACE_MAX_NAMES
+          || (algs[nalgs].name = OPENSSL_zalloc(rec.in_len + 1)) == NULL
+          || fread(algs[nalgs].name, 1, rec.in_len, f) != rec.in_len)
+        goto err;
+      nalgs++;
+      continue;
+    }
+    if (rec.op >= OP_COUNT || rec.alg >= nalgs)
+      goto err;
+    if (!rec.ok) {
+      nfailed++;
+      continue;
+    }
+    if (nrecs == cap) {
+      struct trace_rec *tmp = OPENSSL_realloc(recs, (cap = cap ? 2 * cap : 4096) * sizeof(rec));
+
+      if (tmp == NULL)
+        goto err;
+      recs = tmp;
+    }
+    rec.thread = thread_index(rec.thread);
+    recs[nrecs++] = rec;
+  }
+  ret = 1;
+
+  err:
+  if (f != NULL)
+    fclose(f);
+  return ret;
+}
+
+static EVP_PKEY *keygen(const char *name)
+{
+  EVP_PKEY_CTX *ctx = NULL;
+  EVP_PKEY *key = NULL;
+
+  if ((ctx = EVP_PKEY_CTX_new_from_name(libctx, name, NULL)) == NULL
+      || EVP_PKEY_keygen_init(ctx) <= 0
+      || EVP_PKEY_generate(ctx, &key) <= 0)
+    key = NULL;
+  EVP_PKEY_CTX_free(ctx);
+  return key;
+}
+
+static struct sig_cache *find_sig(struct alg *alg, size_t msglen)
+{
+  size_t i;
+
+  for (i = 0; i < alg->nsigs; i++)
+    if (alg->sigs[i].msglen == msglen)
+      return &alg->sigs[i];
+  return NULL;
+}
+
+/* Everything a record needs besides the timed operation itself */
+static int prepare(const struct trace_rec *rec)
+{
+  struct alg *alg = &algs[rec->alg];
+  EVP_PKEY_CTX *ctx = NULL;
+  unsigned char *secret = NULL;
+  size_t secretlen = 0;
+  int ret = 0;
+
+  if (rec->in_len > sizeof(msgbuf))
+    return 0;
+  if (alg->key == NULL && (alg->key = keygen(alg->name)) == NULL)
+    return 0;
+
+  if (rec->op == OP_DECAPS && alg->ct == NULL) {
+    ret = (ctx = EVP_PKEY_CTX_new_from_pkey(libctx, alg->key, NULL)) != NULL
+          && EVP_PKEY_encapsulate_init(ctx, NULL) > 0
+          && EVP_PKEY_encapsulate(ctx, NULL, &alg->ctlen, NULL, &secretlen) > 0
+          && (alg->ct = OPENSSL_malloc(alg->ctlen)) != NULL
+          && (secret = OPENSSL_malloc(secretlen)) != NULL
+          && EVP_PKEY_encapsulate(ctx, alg->ct, &alg->ctlen, secret, &secretlen) > 0;
+  } else if (rec->op == OP_VERIFY && find_sig(alg, rec->in_len) == NULL) {
+    struct sig_cache *tmp = OPENSSL_realloc(alg->sigs, (alg->nsigs + 1) * sizeof(*tmp));
+    struct sig_cache *sc;
+
+    if (tmp == NULL)
+      return 0;
+    alg->sigs = tmp;
+    sc = &alg->sigs[alg->nsigs];
+    sc->msglen = rec->in_len;
+    sc->sig = NULL;
+    ret = (ctx = EVP_PKEY_CTX_new_from_pkey(libctx, alg->key, NULL)) != NULL
+          && EVP_PKEY_sign_init(ctx) > 0
+          && EVP_PKEY_sign(ctx, NULL, &sc->siglen, msgbuf, sc->msglen) > 0
+          && (sc->sig = OPENSSL_malloc(sc->siglen)) != NULL
+          && EVP_PKEY_sign(ctx, sc->sig, &sc->siglen, msgbuf, sc->msglen) > 0;
+    if (ret)
+      alg->nsigs++;
+    else
+      OPENSSL_free(sc->sig);
+  } else {
+    ret = 1;
+  }
+
+  OPENSSL_free(secret);
+  EVP_PKEY_CTX_free(ctx);
+  return ret;
+}
+
+static int replay(const struct trace_rec *rec)
+{
+  struct alg *alg = &algs[rec->alg];
+  struct sig_cache *sc;
+  EVP_PKEY_CTX *ctx = NULL;
+  EVP_PKEY *key = NULL;
+  unsigned char out[1 << 16], secret[256];
+  size_t outlen = sizeof(out), secretlen = sizeof(secret);
+  int ret = 0;
+
+  switch (rec->op) {
+  case OP_KEYGEN:
+    ret = (key = keygen(alg->name)) != NULL;
+    break;
+  case OP_ENCAPS:
+    ret = (ctx = EVP_PKEY_CTX_new_from_pkey(libctx, alg->key, NULL)) != NULL
+          && EVP_PKEY_encapsulate_init(ctx, NULL) > 0
+          && EVP_PKEY_encapsulate(ctx, out, &outlen, secret, &secretlen) > 0;
+    break;
+  case OP_DECAPS:
+    ret = (ctx = EVP_PKEY_CTX_new_from_pkey(libctx, alg->key, NULL)) != NULL
+          && EVP_PKEY_decapsulate_init(ctx, NULL) > 0
+          && EVP_PKEY_decapsulate(ctx, secret, &secretlen, alg->ct, alg->ctlen) > 0;
+    break;
+  case OP_SIGN:
+    ret = (ctx = EVP_PKEY_CTX_new_from_pkey(libctx, alg->key, NULL)) != NULL
+          && EVP_PKEY_sign_init(ctx) > 0
+          && EVP_PKEY_sign(ctx, out, &outlen, msgbuf, rec->in_len) > 0;
+    break;
+  case OP_VERIFY:
+    ret = (sc = find_sig(alg, rec->in_len)) != NULL
+          && (ctx = EVP_PKEY_CTX_new_from_pkey(libctx, alg->key, NULL)) != NULL
+          && EVP_PKEY_verify_init(ctx) > 0
+          && EVP_PKEY_verify(ctx, sc->sig, sc->siglen, msgbuf, sc->msglen) > 0;
+    break;
+  }
+  EVP_PKEY_free(key);
+  EVP_PKEY_CTX_free(ctx);
+  return ret;
+}
+
+static void *worker_main(void *arg)
+{
+  struct worker *w = arg;
+  const struct trace_rec *rec;
+  struct stats *st;
+  uint64_t t;
+  double us;
+  size_t i;
+
+  for (i = 0; i < nrecs; i++) {
+    rec = &recs[i];
+    if (rec->thread % nthreads != w->index)
+      continue;
+    if (speed > 0)
+      sleep_until(start_ns + (uint64_t)(rec->time_ns / speed));
+    t = now_ns();
+    st = &w->stats[rec->alg][rec->op];
+    if (!replay(rec))
+      st->fails++;
+    us = (now_ns() - t) / 1e3;
+    st->count++;
+    st->total_us += us;
+    st->traced_us += rec->duration_ns / 1e3;
+    if (us > st->max_us)
+      st->max_us = us;
+  }
+  return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+  struct worker *workers = NULL;
+  struct stats total;
+  size_t i, j, k;
+  int errcnt = 0, test = 0, op;
+
+  T((libctx = OSSL_LIB_CTX_new()) != NULL);
+  T(argc >= 4 && argc <= 6);
+  modulename = argv[1];
+  configfile = argv[2];
+  if (argc > 4)
+    speed = strtod(argv[4], NULL);
+  if (argc > 5)
+    T((nthreads = strtoul(argv[5], NULL, 10)) > 0);
+
+  T(OSSL_LIB_CTX_load_config(libctx, configfile));
+  T(OSSL_PROVIDER_available(libctx, modulename));
+  T(read_trace(argv[3]));
+  // an empty trace means nothing was captured
+  T(nrecs > 0);
+
+  for (i = 0; i < nrecs; i++) {
+    if (!prepare(&recs[i])) {
+      fprintf(stderr, cRED "  Cannot prepare %s %s" cNORM "\n",
+              algs[recs[i].alg].name, op_names[recs[i].op]);
+      ERR_print_errors_fp(stderr);
+      errcnt++;
+      break;
+    }
+  }
+
+  T((workers = OPENSSL_zalloc(nthreads * sizeof(*workers))) != NULL);
+  start_ns = now_ns();
+  for (i = 0; errcnt == 0 && i < nthreads; i++) {
+    workers[i].index = i;
+    T(pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]) == 0);
+  }
+  for (i = 0; errcnt == 0 && i < nthreads; i++)
+    pthread_join(workers[i].thread, NULL);
+
+  printf("%zu records replayed in %.3f s (speed %g, %zu threads), %zu failed ones skipped\n",
+         nrecs, (now_ns() - start_ns) / 1e9, speed, nthreads, nfailed);
+  printf("%-28s %-8s %10s %10s %10s %10s %6s\n", "algorithm", "op", "count",
+         "mean_us", "max_us", "traced_us", "fails");
+  for (j = 0; errcnt == 0 && j < nalgs; j++) {
+    for (op = OP_KEYGEN; op < OP_COUNT; op++) {
+      memset(&total, 0, sizeof(total));
+      for (k = 0; k < nthreads; k++) {
+        struct stats *st = &workers[k].stats[j][op];
+
+        total.count += st->count;
+        total.fails += st->fails;
+        total.total_us += st->total_us;
+        total.traced_us += st->traced_us;
+        if (st->max_us > total.max_us)
+          total.max_us = st->max_us;
+      }
+      if (total.count == 0)
+        continue;
+      printf("%-28s %-8s %10zu %10.1f %10.1f %10.1f %6zu\n", algs[j].name,
+             op_names[op], total.count, total.total_us / total.count,
+             total.max_us, total.traced_us / total.count, total.fails);
+      errcnt += total.fails != 0;
+    }
+  }
+
+  for (j = 0; j < nalgs; j++) {
+    for (k = 0; k < algs[j].nsigs; k++)
+      OPENSSL_free(algs[j].sigs[k].sig);
+    OPENSSL_free(algs[j].sigs);
+    OPENSSL_free(algs[j].ct);
+    EVP_PKEY_free(algs[j].key);
+    OPENSSL_free(algs[j].name);
+  }
+  OPENSSL_free(workers);
+  OPENSSL_free(recs);
+  OSSL_LIB_CTX_free(libctx);
+
+  TEST_ASSERT(errcnt == 0)
+  return !test;
+}